@@ -0,0 +1,147 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "tree.h"
+#include "autosave.h"
+
+/* A write or removal waiting for the worker */
+struct request {
+	char path[MAX_ENTRY_LEN + 32];
+	char *data;           /* NULL to remove path */
+	size_t len;
+	struct request *next;
+};
+
+/* static prototypes */
+static void carry_out(struct request *r);
+static void *worker(void *arg);
+static void submit(const char *path, char *data, size_t len);
+
+static pthread_t thread;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static struct request *queue;
+static bool running;
+static bool stopping;
+
+/* start the worker. Without it every request is carried out at once */
+void autosave_start()
+{
+	if (running)
+		return;
+	stopping = false;
+	running = pthread_create(&thread, NULL, worker, NULL) == 0;
+}
+
+/* write len bytes of data to path, replacing anything still waiting */
+void autosave_write(const char *path, char *data, size_t len)
+{
+	submit(path, data, len);
+}
+
+/* remove path once anything waiting for it is done */
+void autosave_remove(const char *path)
+{
+	submit(path, NULL, 0);
+}
+
+/* finish everything waiting and stop the worker */
+void autosave_stop()
+{
+	if (!running)
+		return;
+	pthread_mutex_lock(&lock);
+	stopping = true;
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+	pthread_join(thread, NULL);
+	running = false;
+}
+
+/* queue a request, or carry it out here if there's no worker. A request
+   for a path already queued takes the old one's place, so a worker that
+   falls behind only writes the newest snapshot */
+static void submit(const char *path, char *data, size_t len)
+{
+	struct request *r, **p;
+
+	if (strlen(path) >= sizeof(r->path)) {
+		free(data);
+		return;
+	}
+	pthread_mutex_lock(&lock);
+	for (p = &queue; *p != NULL; p = &(*p)->next) {
+		if (strcmp((*p)->path, path) == 0)
+			break;
+	}
+	if (*p != NULL) {
+		r = *p;
+		free(r->data);
+	} else {
+		r = malloc(sizeof(*r));
+		strcpy(r->path, path);
+		r->next = NULL;
+		*p = r;
+	}
+	r->data = data;
+	r->len = len;
+	if (!running) {
+		queue = r->next;
+		pthread_mutex_unlock(&lock);
+		carry_out(r);
+		return;
+	}
+	pthread_cond_signal(&wake);
+	pthread_mutex_unlock(&lock);
+}
+
+/* take requests off the queue until asked to stop with none left */
+static void *worker(void *arg)
+{
+	struct request *r;
+
+	(void)(arg);
+	pthread_mutex_lock(&lock);
+	for (;;) {
+		while (queue == NULL && !stopping)
+			pthread_cond_wait(&wake, &lock);
+		if (queue == NULL)
+			break;
+		r = queue;
+		queue = r->next;
+		pthread_mutex_unlock(&lock);
+		carry_out(r);
+		pthread_mutex_lock(&lock);
+	}
+	pthread_mutex_unlock(&lock);
+	return NULL;
+}
+
+/* write or remove a request's file and free the request */
+static void carry_out(struct request *r)
+{
+	char tmp[sizeof(r->path) + 4];
+	FILE *f;
+	bool ok;
+
+	if (r->data == NULL) {
+		remove(r->path);
+		free(r);
+		return;
+	}
+	sprintf(tmp, "%s.tmp", r->path);
+	f = fopen(tmp, "w");
+	if (f != NULL) {
+		ok = fwrite(r->data, 1, r->len, f) == r->len && fflush(f) == 0
+			&& fsync(fileno(f)) == 0;
+		if (fclose(f) == 0 && ok)
+			rename(tmp, r->path);
+		else
+			remove(tmp);
+	}
+	free(r->data);
+	free(r);
+}
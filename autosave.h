@@ -0,0 +1,25 @@
+#ifndef TT_AUTOSAVE_H
+#define TT_AUTOSAVE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Recovery files are written by a worker thread so that a large tree
+   never holds up the interface. The caller hands over a snapshot of the
+   tree in memory; the tree itself is never touched off the main thread */
+
+/* start the worker. Without it every request is carried out at once */
+void autosave_start();
+
+/* write len bytes of data to path, replacing any write or removal of path
+   still waiting. data is malloc'd and freed once written. The file is
+   written under a temporary name and renamed, so it's always whole */
+void autosave_write(const char *path, char *data, size_t len);
+
+/* remove path once anything waiting for it is done */
+void autosave_remove(const char *path);
+
+/* finish everything waiting and stop the worker */
+void autosave_stop();
+
+#endif /* TT_AUTOSAVE_H */
@@ -0,0 +1,647 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "tree.h"
+#include "diff.h"
+#include "export.h"
+#include "format.h"
+#include "gen.h"
+#include "sort.h"
+#include "tags.h"
+#include "batch.h"
+
+/* size of the stdio buffers used for stdin and stdout */
+#define BATCH_BUFSIZE (1 << 16)
+
+/* A headless command */
+struct command {
+	const char *name;
+	const char *args;
+	const char *help;
+	int (*run)(int argc, char *argv[]);
+};
+
+/* static prototypes */
+static int cmd_convert(int argc, char *argv[]);
+static int cmd_count(int argc, char *argv[]);
+static int cmd_diff(int argc, char *argv[]);
+static int cmd_export(int argc, char *argv[]);
+static int cmd_extract(int argc, char *argv[]);
+static int cmd_format(int argc, char *argv[]);
+static int cmd_generate(int argc, char *argv[]);
+static int cmd_import(int argc, char *argv[]);
+static int cmd_merge(int argc, char *argv[]);
+static int cmd_query(int argc, char *argv[]);
+static int cmd_repair(int argc, char *argv[]);
+static int cmd_sort(int argc, char *argv[]);
+static int cmd_validate(int argc, char *argv[]);
+static int by_text(const void *a, const void *b);
+static int input_error(const char *name);
+static void merge_tree(struct tree *dst, struct tree *src);
+static bool parse_indent(int argc, char *argv[], struct fmt_options *opt);
+static void print_path(struct tree *t, FILE *f);
+static struct tree *read_file(const char *name);
+static struct tree *read_input(FILE *f);
+static int stream(struct fmt_options *opt, struct fmt_result *res);
+static void usage();
+static void write_forest(struct tree *t, FILE *f);
+static void *xmalloc(size_t size);
+
+static const struct command commands[] = {
+	{ "convert",  "[-t|-s N]", "re-indent with tabs (default) or N spaces",
+		cmd_convert },
+	{ "count",    "",          "print the number of entries",
+		cmd_count },
+	{ "diff",     "OLD NEW",   "print the entries added (+) and removed (-) "
+		"from OLD to NEW", cmd_diff },
+	{ "export",   "FORMAT",    "write the input as md, json, jsonflat or opml",
+		cmd_export },
+	{ "extract",  "PATH",      "print the subtree at PATH, e.g. a/b/c",
+		cmd_extract },
+	{ "format",   "[-t|-s N]", "re-indent and strip trailing whitespace",
+		cmd_format },
+	{ "generate", "[-dflns N]", "write a synthetic tree (depth, fanout, "
+		"text length, entries, seed)", cmd_generate },
+	{ "import",   "FORMAT",    "read md, json, jsonflat or opml as a tree file",
+		cmd_import },
+	{ "merge",    "[BASE] FILE", "merge FILE into the input by entry text, "
+		"or the changes from BASE to FILE", cmd_merge },
+	{ "query",    "[-u PATH] TAG...", "print the path of each entry with "
+		"every #tag and @key=value, or only those under PATH", cmd_query },
+	{ "repair",   "",          "attach mis-indented entries to the nearest "
+		"parent, listing each fix", cmd_repair },
+	{ "sort",     "[-n|-c]",   "sort every entry's children by text, "
+		"numbers in text (-n) or entry count (-c)", cmd_sort },
+	{ "validate", "",          "exit with status 1 if the input is malformed",
+		cmd_validate },
+};
+
+#define NCOMMANDS (sizeof(commands) / sizeof(commands[0]))
+
+/* the command being run and the input being read, kept here so errors
+   can report the command and line number */
+static const struct command *cmd;
+static struct reader in;
+
+/* run the headless command named by argv[0] with the remaining arguments */
+int batch(int argc, char *argv[])
+{
+	int status;
+	unsigned int i;
+
+	if (argc < 1) {
+		usage();
+		return 2;
+	}
+	for (i = 0; i < NCOMMANDS; i++) {
+		if (strcmp(argv[0], commands[i].name) == 0)
+			cmd = &commands[i];
+	}
+	if (cmd == NULL) {
+		fprintf(stderr, "tt: unknown command '%s'\n", argv[0]);
+		usage();
+		return 2;
+	}
+
+	setvbuf(stdin, NULL, _IOFBF, BATCH_BUFSIZE);
+	setvbuf(stdout, NULL, _IOFBF, BATCH_BUFSIZE);
+
+	status = cmd->run(argc, argv);
+	if (fflush(stdout) != 0) {
+		fprintf(stderr, "tt %s: error writing output\n", cmd->name);
+		status = 1;
+	}
+	return status;
+}
+
+/* print the list of commands */
+static void usage()
+{
+	unsigned int i;
+	fprintf(stderr, "usage: tt -b COMMAND [ARGS] < INPUT > OUTPUT\n");
+	for (i = 0; i < NCOMMANDS; i++) {
+		fprintf(stderr, "  %-9s %-10s %s\n", commands[i].name,
+				commands[i].args, commands[i].help);
+	}
+}
+
+/* parse the indentation options of convert and format */
+static bool parse_indent(int argc, char *argv[], struct fmt_options *opt)
+{
+	memset(opt, 0, sizeof(*opt));
+	opt->indent = '\t';
+	if (argc < 2 || strcmp(argv[1], "-t") == 0)
+		return argc <= 2;
+	if (strcmp(argv[1], "-s") != 0 || argc != 3)
+		return false;
+	opt->indent = ' ';
+	opt->width = atoi(argv[2]);
+	return opt->width > 0;
+}
+
+/* run the streaming formatter from stdin to stdout, reporting any error */
+static int stream(struct fmt_options *opt, struct fmt_result *res)
+{
+	enum errcode err = format_stream(stdin, stdout, opt, res);
+
+	if (err == ERR_FORMAT) {
+		fprintf(stderr, "tt %s: stdin:%ld:%d: %s%s\n", cmd->name,
+				res->lines, res->column, errstrings[err], res->msg);
+		return 1;
+	} else if (err != ERR_NONE) {
+		fprintf(stderr, "tt %s: %s%s\n", cmd->name, errstrings[err],
+				res->msg);
+		return 1;
+	}
+	return 0;
+}
+
+/* report the error that stopped the input named name, returning the
+   exit status */
+static int input_error(const char *name)
+{
+	fprintf(stderr, "tt %s: %s:%ld:%d: %s%s\n", cmd->name, name, in.line,
+			in.column, errstrings[in.err], in.msg);
+	return 1;
+}
+
+/* allocate or exit; batch commands have nothing to save on failure */
+static void *xmalloc(size_t size)
+{
+	void *p = malloc(size);
+	if (p == NULL) {
+		fprintf(stderr, "tt %s: out of memory\n", cmd->name);
+		exit(1);
+	}
+	return p;
+}
+
+/* read every top level entry in f as children of a new root node,
+   returning NULL if the input is malformed */
+static struct tree *read_input(FILE *f)
+{
+	struct tree *t = add_child(NULL, "");
+	reader_init(&in, f);
+	if (read_forest(&in, t) != ERR_NONE) {
+		free_tree(t);
+		return NULL;
+	}
+	return t;
+}
+
+/* read the file name, or stdin if it's "-", reporting any error */
+static struct tree *read_file(const char *name)
+{
+	struct tree *t;
+	FILE *f;
+
+	if (strcmp(name, "-") == 0) {
+		t = read_input(stdin);
+		name = "stdin";
+	} else {
+		f = fopen(name, "r");
+		if (f == NULL) {
+			fprintf(stderr, "tt %s: %s: %s\n", cmd->name, name,
+					strerror(errno));
+			return NULL;
+		}
+		t = read_input(f);
+		fclose(f);
+	}
+	if (t == NULL)
+		input_error(name);
+	return t;
+}
+
+/* write the children of t as top level entries */
+static void write_forest(struct tree *t, FILE *f)
+{
+	int i;
+	for (i = 0; i < t->nchild; i++) {
+		write_tree(t->child[i], f, 0);
+	}
+}
+
+/* write the text of t's ancestors below the root and t, separated by
+   '/', as extract takes them */
+static void print_path(struct tree *t, FILE *f)
+{
+	if (t->parent == NULL)
+		return;
+	if (t->parent->parent != NULL) {
+		print_path(t->parent, f);
+		putc('/', f);
+	}
+	fputs(t->text, f);
+}
+
+/* qsort / bsearch comparison of two node pointers by text */
+static int by_text(const void *a, const void *b)
+{
+	const struct tree *ta = *(struct tree * const *)a;
+	const struct tree *tb = *(struct tree * const *)b;
+	return strcmp(ta->text, tb->text);
+}
+
+/* move the children of src into dst, merging children that have the same
+   text. src is consumed */
+static void merge_tree(struct tree *dst, struct tree *src)
+{
+	struct tree **index = NULL;
+	struct tree **found;
+	int n = dst->nchild;
+	int i;
+
+	/* index dst's children by text so each lookup is O(log n) */
+	if (n > 0) {
+		index = xmalloc(sizeof(*index) * n);
+		memcpy(index, dst->child, sizeof(*index) * n);
+		qsort(index, n, sizeof(*index), by_text);
+	}
+	for (i = 0; i < src->nchild; i++) {
+		struct tree *c = src->child[i];
+		found = n > 0 ? bsearch(&c, index, n, sizeof(*index), by_text)
+			: NULL;
+		if (found != NULL) {
+			merge_tree(*found, c);
+		} else {
+			add_leaf(dst, c);
+		}
+	}
+	free(index);
+	src->nchild = 0;
+	free_node(src);
+}
+
+/******************************************************************************
+	Commands
+*/
+
+/* convert [-t|-s N]: re-indent the input without building the tree */
+static int cmd_convert(int argc, char *argv[])
+{
+	struct fmt_options opt;
+	struct fmt_result res;
+
+	if (!parse_indent(argc, argv, &opt)) {
+		usage();
+		return 2;
+	}
+	return stream(&opt, &res);
+}
+
+/* count: print the number of entries without building the tree */
+static int cmd_count(int argc, char *argv[])
+{
+	struct fmt_options opt;
+	struct fmt_result res;
+	int status;
+
+	(void)(argc);
+	(void)(argv);
+	memset(&opt, 0, sizeof(opt));
+	opt.check = true;
+	status = stream(&opt, &res);
+	if (status == 0)
+		printf("%ld\n", res.lines);
+	return status;
+}
+
+/* diff OLD NEW: print the changes from OLD to NEW as a tree, exiting
+   with status 1 if there are any */
+static int cmd_diff(int argc, char *argv[])
+{
+	struct tree *a, *b;
+	long changes;
+
+	if (argc != 3) {
+		usage();
+		return 2;
+	}
+	if ((a = read_file(argv[1])) == NULL)
+		return 1;
+	if ((b = read_file(argv[2])) == NULL) {
+		free_tree(a);
+		return 1;
+	}
+	changes = diff_trees(a, b, stdout);
+	free_tree(a);
+	free_tree(b);
+	return changes > 0 ? 1 : 0;
+}
+
+/* export FORMAT: write the input in another format. Entries go to the
+   writer as they're read, so only the path to the current one is kept */
+static int cmd_export(int argc, char *argv[])
+{
+	enum export_format fmt;
+	struct writer w;
+	int prev = -1;
+
+	if (argc != 2 || !format_named(argv[1], &fmt)) {
+		usage();
+		return 2;
+	}
+	reader_init(&in, stdin);
+	writer_begin(&w, stdout, fmt);
+	while (in.have) {
+		if (in.depth > prev + 1) {
+			reader_error(&in, ERR_FORMAT, "invalid indentation");
+			break;
+		}
+		writer_entry(&w, in.depth, in.text);
+		prev = in.depth;
+		next_line(&in);
+	}
+	writer_end(&w);
+	if (in.err != ERR_NONE)
+		return input_error("stdin");
+	return 0;
+}
+
+/* extract PATH: print the subtree at PATH, re-indented to the top level.
+   Matching is done line by line, so only the path is kept in memory */
+static int cmd_extract(int argc, char *argv[])
+{
+	char **part;
+	char *p;
+	int nparts = 0;
+	int matched = 0;
+	int prev = -1;
+	int found = 0;
+	int i;
+
+	if (argc < 2) {
+		usage();
+		return 2;
+	}
+	part = xmalloc(sizeof(*part) * (strlen(argv[1]) + 1));
+	for (p = strtok(argv[1], "/"); p != NULL; p = strtok(NULL, "/")) {
+		part[nparts++] = p;
+	}
+	if (nparts == 0) {
+		free(part);
+		usage();
+		return 2;
+	}
+
+	reader_init(&in, stdin);
+	while (in.have) {
+		if (in.depth > prev + 1) {
+			reader_error(&in, ERR_FORMAT, "invalid indentation");
+			break;
+		}
+		/* matched counts the path components matched by the current
+		   line's ancestors, and can't exceed the current depth */
+		if (matched > in.depth)
+			matched = in.depth;
+		if (matched == in.depth && in.depth < nparts
+				&& strcmp(in.text, part[in.depth]) == 0) {
+			matched++;
+			if (matched == nparts)
+				found++;
+		}
+		if (matched == nparts) {
+			for (i = nparts - 1; i < in.depth; i++) {
+				putc('\t', stdout);
+			}
+			fputs(in.text, stdout);
+			putc('\n', stdout);
+		}
+		prev = in.depth;
+		next_line(&in);
+	}
+	free(part);
+	if (in.err != ERR_NONE)
+		return input_error("stdin");
+	return found > 0 ? 0 : 1;
+}
+
+/* format [-t|-s N]: re-indent and strip trailing whitespace */
+static int cmd_format(int argc, char *argv[])
+{
+	struct fmt_options opt;
+	struct fmt_result res;
+
+	if (!parse_indent(argc, argv, &opt)) {
+		usage();
+		return 2;
+	}
+	opt.trim = true;
+	return stream(&opt, &res);
+}
+
+/* generate [-dflns N]: write a synthetic tree */
+static int cmd_generate(int argc, char *argv[])
+{
+	struct gen_options opt;
+	int i;
+
+	gen_defaults(&opt);
+	for (i = 1; i < argc; i += 2) {
+		if (!gen_flag(&opt, argv[i], i + 1 < argc ? argv[i+1] : NULL)) {
+			usage();
+			return 2;
+		}
+	}
+	generate(stdout, &opt);
+	return 0;
+}
+
+/* import FORMAT: read another format and write it as a tree file */
+static int cmd_import(int argc, char *argv[])
+{
+	enum export_format fmt;
+	struct tree *t;
+
+	if (argc != 2 || !format_named(argv[1], &fmt)) {
+		usage();
+		return 2;
+	}
+	t = add_child(NULL, "");
+	if (import_tree(&in, stdin, fmt, t) != ERR_NONE) {
+		free_tree(t);
+		return input_error("stdin");
+	}
+	write_forest(t, stdout);
+	free_tree(t);
+	return 0;
+}
+
+/* merge [BASE] FILE: merge the entries in FILE into the input, or with
+   BASE merge the changes made from BASE to FILE into the changes made
+   from BASE to the input, exiting with status 1 on conflicts */
+static int cmd_merge(int argc, char *argv[])
+{
+	struct tree *base = NULL;
+	struct tree *dst, *src;
+	long conflicts = 0;
+
+	if (argc < 2 || argc > 3) {
+		usage();
+		return 2;
+	}
+	if (argc == 3 && (base = read_file(argv[1])) == NULL)
+		return 1;
+	if ((src = read_file(argv[argc-1])) == NULL) {
+		if (base != NULL)
+			free_tree(base);
+		return 1;
+	}
+	dst = read_input(stdin);
+	if (dst == NULL) {
+		free_tree(src);
+		if (base != NULL)
+			free_tree(base);
+		return input_error("stdin");
+	}
+	if (base == NULL) {
+		merge_tree(dst, src);
+	} else {
+		conflicts = merge_trees(base, dst, src);
+		free_tree(src);
+		free_tree(base);
+	}
+	write_forest(dst, stdout);
+	free_tree(dst);
+	if (conflicts > 0) {
+		fprintf(stderr, "tt merge: %ld conflicts, marked with '%s'\n",
+				conflicts, MERGE_CONFLICT);
+		return 1;
+	}
+	return 0;
+}
+
+/* query [-u PATH] TAG...: print the path of every entry with all of the
+   tags and attributes, exiting with status 1 if there are none */
+static int cmd_query(int argc, char *argv[])
+{
+	struct tag_found found;
+	struct tree *t, *under;
+	char *query, *path, *p;
+	size_t len = 0;
+	long i, n;
+	int first = 1, j;
+
+	if (argc > 2 && strcmp(argv[1], "-u") == 0)
+		first = 3;
+	if (argc <= first) {
+		usage();
+		return 2;
+	}
+	for (j = first; j < argc; j++) {
+		len += strlen(argv[j]) + 1;
+	}
+	query = xmalloc(len);
+	query[0] = '\0';
+	for (j = first; j < argc; j++) {
+		if (j > first)
+			strcat(query, " ");
+		strcat(query, argv[j]);
+	}
+	if ((t = read_input(stdin)) == NULL) {
+		free(query);
+		return input_error("stdin");
+	}
+
+	/* follow PATH down by text, the first child matching each part */
+	under = t;
+	if (first == 3) {
+		path = xmalloc(strlen(argv[2]) + 1);
+		strcpy(path, argv[2]);
+		for (p = strtok(path, "/"); p != NULL && under != NULL;
+				p = strtok(NULL, "/")) {
+			for (j = 0; j < under->nchild
+					&& strcmp(under->child[j]->text, p) != 0; j++)
+				;
+			under = j < under->nchild ? under->child[j] : NULL;
+		}
+		free(path);
+		if (under == NULL) {
+			fprintf(stderr, "tt query: no entry at %s\n", argv[2]);
+			free(query);
+			free_tree(t);
+			return 1;
+		}
+	}
+	if ((n = tag_query(under, query, &found)) < 0) {
+		fprintf(stderr, "tt query: '%s' isn't a list of #tags and "
+				"@key=value attributes\n", query);
+		free(query);
+		free_tree(t);
+		return 2;
+	}
+	for (i = 0; i < n; i++) {
+		print_path(found.node[i], stdout);
+		putc('\n', stdout);
+	}
+	free(query);
+	free_tree(t);
+	return n > 0 ? 0 : 1;
+}
+
+/* repair: read the input in recovery mode and write it back out with
+   consistent indentation, listing each fix. Exits with status 1 if
+   anything had to be fixed */
+static int cmd_repair(int argc, char *argv[])
+{
+	struct tree *t = add_child(NULL, "");
+	int status;
+	int i;
+
+	(void)(argc);
+	(void)(argv);
+	reader_init(&in, stdin);
+	in.recover = true;
+	if (read_forest(&in, t) != ERR_NONE) {
+		free_tree(t);
+		reader_free(&in);
+		return input_error("stdin");
+	}
+	write_forest(t, stdout);
+	for (i = 0; i < in.nproblems; i++) {
+		fprintf(stderr, "tt repair: stdin:%ld:%d: fixed: %s\n",
+				in.problems[i].line, in.problems[i].column,
+				in.problems[i].msg);
+	}
+	status = in.nproblems > 0 ? 1 : 0;
+	free_tree(t);
+	reader_free(&in);
+	return status;
+}
+
+/* sort [-n|-c]: sort every entry's children */
+static int cmd_sort(int argc, char *argv[])
+{
+	enum sort_order order = SORT_ALPHA;
+	struct tree *t;
+
+	if (argc > 2 || (argc == 2 && strcmp(argv[1], "-n") != 0
+				&& strcmp(argv[1], "-c") != 0)) {
+		usage();
+		return 2;
+	}
+	if (argc == 2)
+		order = argv[1][1] == 'n' ? SORT_NATURAL : SORT_SIZE;
+	t = read_input(stdin);
+	if (t == NULL)
+		return input_error("stdin");
+	sort_tree(t, order, true);
+	write_forest(t, stdout);
+	free_tree(t);
+	return 0;
+}
+
+/* validate: check indentation without building the tree */
+static int cmd_validate(int argc, char *argv[])
+{
+	struct fmt_options opt;
+	struct fmt_result res;
+
+	(void)(argc);
+	(void)(argv);
+	memset(&opt, 0, sizeof(opt));
+	opt.check = true;
+	return stream(&opt, &res);
+}
@@ -0,0 +1,8 @@
+#ifndef TT_BATCH_H
+#define TT_BATCH_H
+
+/* run the headless command named by argv[0] with the remaining arguments,
+   reading a tree on stdin and writing to stdout. returns the exit status */
+int batch(int argc, char *argv[]);
+
+#endif /* TT_BATCH_H */
@@ -0,0 +1,450 @@
+#include <ncurses.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include "tree.h"
+#include "export.h"
+#include "gen.h"
+#include "sort.h"
+#include "stats.h"
+#include "tt.h"
+
+/******************************************************************************
+	Benchmarks for the load, save, render, sort and edit hot paths. Each result
+	is printed as one JSON object per line:
+
+	{"bench":"load","items":200000,"bytes":9500000,"secs":0.1,
+	 "items_per_sec":2000000,"mb_per_sec":95,"peak_rss_kb":40000}
+
+	Rendering uses the headless framebuffer, and a script of keys is then
+	replayed through the editor's dispatch, reporting each key's latency
+	to a painted frame along with the cells it wrote and the bytes a
+	terminal would have been sent. In a script each character is a key,
+	except that newlines are ignored, <up> <down> <left> <right> are the
+	arrow keys and {text} answers a prompt opened by the previous key.
+*/
+
+/* file the synthetic tree is written to */
+#define BENCH_FILE "ttbench.tree"
+
+/* size of the headless screen used for rendering */
+#define BENCH_ROWS 60
+#define BENCH_COLS 160
+
+/* keys replayed when no script is given: walk down through the top of
+   the tree folding and unfolding entries, toggle the help and stats,
+   then walk back up */
+#define BENCH_KEYS "jjjjjjjjjjhljjjjjhlhl?jjjjjjjjjj?Tkkkkkkkkkkkkkkkkkkkk" \
+	"<down><down><up><up>T"
+
+/* a key to replay and the answer to any prompt it opens */
+struct key {
+	int c;
+	char *answer;
+};
+
+/* static prototypes */
+static long collect(struct tree *t, struct tree **all, long n);
+static void edit(const char *name, void (*op)(), struct tree **all,
+		long nodes, long edits);
+static void expand_all(struct tree *t);
+static const char *key_name(int c);
+static long parse_keys(const char *script, struct key *keys);
+static char *read_script(const char *fname);
+static void replay(struct key *keys, long n);
+static char *scripted(const char *msgstr, const char *defstr);
+static void readd();
+static double now();
+static void report(const char *name, long items, long bytes, double secs);
+static void usage();
+
+int main(int argc, char *argv[])
+{
+	struct gen_options opt;
+	struct reader rd;
+	struct tree *forest;
+	struct tree **all;
+	struct key *keys;
+	char *script = NULL;
+	long frames = 200;
+	long edits = 20000;
+	long bytes, nodes, i;
+	char sname[MAX_ENTRY_LEN + 16];
+	FILE *f;
+	double t;
+
+	gen_defaults(&opt);
+	for (i = 1; i < argc; i += 2) {
+		const char *val = i + 1 < argc ? argv[i+1] : NULL;
+		if (strcmp(argv[i], "-r") == 0 && val != NULL)
+			frames = atol(val);
+		else if (strcmp(argv[i], "-e") == 0 && val != NULL)
+			edits = atol(val);
+		else if (strcmp(argv[i], "-k") == 0 && val != NULL)
+			script = read_script(val);
+		else if (!gen_flag(&opt, argv[i], val))
+			usage();
+	}
+	printf("{\"bench\":\"config\",\"depth\":%d,\"fanout\":%d,"
+			"\"textlen\":%d,\"lines\":%ld,\"seed\":%lu,"
+			"\"frames\":%ld,\"edits\":%ld}\n",
+			opt.depth, opt.fanout, opt.textlen, opt.lines, opt.seed,
+			frames, edits);
+
+	/* generate */
+	f = fopen(BENCH_FILE, "w");
+	if (f == NULL) {
+		perror(BENCH_FILE);
+		return 1;
+	}
+	t = now();
+	bytes = generate(f, &opt);
+	fclose(f);
+	report("generate", opt.lines, bytes, now() - t);
+
+	/* read_tree and free_tree on their own */
+	f = fopen(BENCH_FILE, "r");
+	t = now();
+	forest = add_child(NULL, "");
+	reader_init(&rd, f);
+	read_forest(&rd, forest);
+	report("read_tree", opt.lines, bytes, now() - t);
+	fclose(f);
+	t = now();
+	free_tree(forest);
+	report("free_tree", opt.lines, bytes, now() - t);
+
+	/* load and save through the editor */
+	t = now();
+	load(BENCH_FILE);
+	report("load", opt.lines, bytes, now() - t);
+	f = fopen("/dev/null", "w");
+	t = now();
+	for (i = 0; i < root->nchild; i++) {
+		write_tree(root->child[i], f, 0);
+	}
+	fclose(f);
+	report("write_tree", opt.lines, bytes, now() - t);
+	for (i = EXPORT_MD; i < EXPORT_COUNT; i++) {
+		char name[32];
+		f = fopen("/dev/null", "w");
+		t = now();
+		export_tree(root, f, (enum export_format)i);
+		fclose(f);
+		sprintf(name, "export_%s", exporters[i].name);
+		report(name, opt.lines, bytes, now() - t);
+	}
+	t = now();
+	saveas(BENCH_FILE);
+	report("saveas", opt.lines, bytes, now() - t);
+	/* reading the unchanged file again only patches the tree */
+	t = now();
+	reload();
+	report("reload", opt.lines, bytes, now() - t);
+
+	/* render into the headless framebuffer */
+	r_headless(BENCH_ROWS, BENCH_COLS);
+	resize();
+	expand_all(root);
+	vscroll = 0;
+	t = now();
+	for (i = 0; i < frames; i++) {
+		print_tree(A_STANDOUT);
+	}
+	report("print_tree_top", frames, 0, now() - t);
+	/* scrolled to the end the row index has to reach every node, which
+	   it does again each time the tree changes */
+	vscroll = opt.lines + 1 - tree_win_height;
+	if (vscroll < 0)
+		vscroll = 0;
+	t = now();
+	for (i = 0; i < frames / 10 + 1; i++) {
+		view_root = NULL;
+		print_tree(A_STANDOUT);
+	}
+	report("print_tree_end", frames / 10 + 1, 0, now() - t);
+	/* while nothing changes the rows come straight from the index */
+	t = now();
+	for (i = 0; i < frames; i++) {
+		print_tree(A_STANDOUT);
+	}
+	report("print_tree_end_cached", frames, 0, now() - t);
+	/* a change onscreen only drops and fills in the rows below it */
+	t = now();
+	for (i = 0; i < frames; i++) {
+		selected_entry = onscreen_entries[tree_win_height / 2];
+		set_fold(selected_entry->state == EXPANDED ? COLLAPSED : EXPANDED);
+		print_tree(A_STANDOUT);
+	}
+	report("print_tree_end_fold", frames, 0, now() - t);
+
+	/* replay keys through the editor from the top of the tree */
+	vscroll = 0;
+	selected_entry = root;
+	keys = malloc(sizeof(*keys) * (strlen(script ? script : BENCH_KEYS) + 1));
+	replay(keys, parse_keys(script ? script : BENCH_KEYS, keys));
+	free(keys);
+	free(script);
+
+	/* fold the whole tree and draw the result, which only touches the
+	   nodes onscreen */
+	vscroll = 0;
+	selected_entry = root;
+	t = now();
+	fold_branch(0);
+	print_tree(A_STANDOUT);
+	fold_branch(FOLD_ALL);
+	print_tree(A_STANDOUT);
+	report("fold_all", 2, 0, now() - t);
+
+	/* sort every entry's children, on worker threads if there are cpus */
+	t = now();
+	nodes = sort_tree(root, SORT_NATURAL, true);
+	report("sort_tree", nodes, 0, now() - t);
+
+	/* structural edits on randomly chosen entries */
+	all = malloc(sizeof(*all) * stats.nodes);
+	nodes = collect(root, all, 0);
+	srand(opt.seed);
+	edit("shove_up", shove_up, all, nodes, edits);
+	edit("demote", demote, all, nodes, edits);
+	edit("promote", promote, all, nodes, edits);
+	edit("del_child", readd, all, nodes, edits);
+	free(all);
+
+	t = now();
+	free_tree(root);
+	root = NULL;
+	report("free_tree_loaded", nodes, bytes, now() - t);
+
+	state_name(BENCH_FILE, sname);
+	remove(sname);
+	remove(BENCH_FILE);
+	return 0;
+}
+
+/* print the options and quit */
+static void usage()
+{
+	fprintf(stderr, "usage: ttbench [-d depth] [-f fanout] [-l textlen] "
+			"[-n lines] [-s seed] [-r frames] [-e edits] [-k script]\n");
+	exit(2);
+}
+
+/* monotonic time in seconds */
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* print one result line */
+static void report(const char *name, long items, long bytes, double secs)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	if (secs <= 0)
+		secs = 1e-9;
+	printf("{\"bench\":\"%s\",\"items\":%ld,\"bytes\":%ld,\"secs\":%.6f,"
+			"\"items_per_sec\":%.0f,\"mb_per_sec\":%.1f,"
+			"\"peak_rss_kb\":%ld}\n",
+			name, items, bytes, secs, items / secs,
+			bytes / secs / 1e6, (long)ru.ru_maxrss);
+	fflush(stdout);
+}
+
+/* store t and its descendants in all, in preorder, from index n */
+static long collect(struct tree *t, struct tree **all, long n)
+{
+	int i;
+	all[n++] = t;
+	for (i = 0; i < t->nchild; i++) {
+		n = collect(t->child[i], all, n);
+	}
+	return n;
+}
+
+/* time op applied to randomly chosen entries other than the root */
+static void edit(const char *name, void (*op)(), struct tree **all,
+		long nodes, long edits)
+{
+	double t = now();
+	long i;
+
+	if (nodes < 2)
+		return;
+	for (i = 0; i < edits; i++) {
+		selected_entry = all[1 + rand() % (nodes - 1)];
+		op();
+	}
+	report(name, edits, 0, now() - t);
+}
+
+/* remove the selected entry and add it back as its parent's last child */
+static void readd()
+{
+	struct tree *parent = selected_entry->parent;
+	add_leaf(parent, del_child(selected_entry));
+}
+
+/* expand every entry so rendering visits the whole tree */
+static void expand_all(struct tree *t)
+{
+	int i;
+	if (t->nchild > 0)
+		t->state = EXPANDED;
+	for (i = 0; i < t->nchild; i++) {
+		expand_all(t->child[i]);
+	}
+}
+
+/* read a whole key script into memory */
+static char *read_script(const char *fname)
+{
+	FILE *f = fopen(fname, "r");
+	char *buf;
+	long len;
+
+	if (f == NULL) {
+		perror(fname);
+		exit(1);
+	}
+	fseek(f, 0, SEEK_END);
+	len = ftell(f);
+	rewind(f);
+	buf = malloc(len + 1);
+	len = fread(buf, 1, len, f);
+	buf[len] = '\0';
+	fclose(f);
+	return buf;
+}
+
+/* split a key script into keys, returning how many there are. Prompt
+   answers are terminated in place, so script must outlive keys */
+static long parse_keys(const char *script, struct key *keys)
+{
+	static const struct {
+		const char *name;
+		int c;
+	} named[] = {
+		{ "<up>", KEY_UP },
+		{ "<down>", KEY_DOWN },
+		{ "<left>", KEY_LEFT },
+		{ "<right>", KEY_RIGHT },
+	};
+	char *p = (char *)script;
+	char *end;
+	long n = 0;
+	unsigned int i;
+
+	while (*p != '\0') {
+		if (*p == '\n') {
+			p++;
+			continue;
+		}
+		if (*p == '{' && n > 0 && (end = strchr(p, '}')) != NULL) {
+			*end = '\0';
+			keys[n-1].answer = p + 1;
+			p = end + 1;
+			continue;
+		}
+		keys[n].c = (unsigned char)*p;
+		keys[n].answer = NULL;
+		for (i = 0; i < sizeof(named) / sizeof(named[0]); i++) {
+			if (strncmp(p, named[i].name, strlen(named[i].name)) == 0) {
+				keys[n].c = named[i].c;
+				p += strlen(named[i].name) - 1;
+				break;
+			}
+		}
+		p++;
+		n++;
+	}
+	return n;
+}
+
+/* the answer for the prompt opened by the key being replayed */
+static const char *answer;
+
+/* prompt source used while replaying: answer from the script, once */
+static char *scripted(const char *msgstr, const char *defstr)
+{
+	char *str;
+	(void)(msgstr);
+	(void)(defstr);
+	if (answer == NULL)
+		return NULL;
+	str = malloc(strlen(answer) + 1);
+	strcpy(str, answer);
+	answer = NULL;
+	return str;
+}
+
+/* printable name of a replayed key for the JSON output */
+static const char *key_name(int c)
+{
+	static char name[8];
+	switch (c) {
+	case KEY_UP:    return "<up>";
+	case KEY_DOWN:  return "<down>";
+	case KEY_LEFT:  return "<left>";
+	case KEY_RIGHT: return "<right>";
+	}
+	if (c == '"' || c == '\\')
+		sprintf(name, "\\%c", c);
+	else if (c >= ' ' && c < 0x7f)
+		sprintf(name, "%c", c);
+	else
+		sprintf(name, "\\u%04x", c & 0xff);
+	return name;
+}
+
+/* dispatch each key and paint the result, timing every one */
+static void replay(struct key *keys, long n)
+{
+	struct render_counts start = render_counts;
+	struct render_counts before;
+	double t, secs, total = 0, worst = 0;
+	bool quit = false;
+	long i;
+
+	prompt_source = scripted;
+	redraw();
+	paint();
+	for (i = 0; i < n && !quit; i++) {
+		before = render_counts;
+		answer = keys[i].answer;
+		say("");
+		t = now();
+		quit = dispatch(keys[i].c);
+		redraw();
+		paint();
+		secs = now() - t;
+		total += secs;
+		if (secs > worst)
+			worst = secs;
+		printf("{\"bench\":\"key\",\"index\":%ld,\"key\":\"%s\","
+				"\"secs\":%.6f,\"cells\":%ld,\"changed\":%ld,"
+				"\"bytes\":%ld}\n",
+				i, key_name(keys[i].c), secs,
+				render_counts.cells - before.cells,
+				render_counts.changed - before.changed,
+				render_counts.bytes - before.bytes);
+	}
+	prompt_source = NULL;
+	if (total <= 0)
+		total = 1e-9;
+	printf("{\"bench\":\"replay\",\"keys\":%ld,\"secs\":%.6f,"
+			"\"keys_per_sec\":%.0f,\"max_key_secs\":%.6f,"
+			"\"cells\":%ld,\"changed\":%ld,\"bytes\":%ld}\n",
+			i, total, i / total, worst,
+			render_counts.cells - start.cells,
+			render_counts.changed - start.changed,
+			render_counts.bytes - start.bytes);
+	fflush(stdout);
+}
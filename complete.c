@@ -0,0 +1,295 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "complete.h"
+#include "tags.h"
+
+/* Sorted candidates. Their text is added to one block, one string after
+   another, and item points into it once the list is sorted */
+struct list {
+	char **item;
+	long n;
+	char *text;
+	size_t used;
+	size_t size;
+};
+
+/* a string with its first bytes packed in order into an integer, which
+   settles most comparisons without reaching the text */
+struct keyed {
+	unsigned long key;
+	char *s;
+};
+
+/* static prototypes */
+static void list_clear(struct list *l);
+static void list_add(struct list *l, const char *s, size_t n,
+		const char *suffix);
+static void list_sort(struct list *l);
+static long list_match(struct list *l, const char *prefix, int len,
+		char ***matches);
+static void sort_keyed(struct keyed *k, long n);
+static int cmp_keyed(const void *a, const void *b);
+static void add_entries(struct list *l, struct tree *t);
+
+/* the last directory listed */
+static struct list files;
+static char files_dir[MAXLEN + 1];
+static time_t files_mtime;
+static bool files_hidden;
+static bool files_valid;
+
+/* the entries of the last tree listed */
+static struct list entries;
+static struct tree *entries_tree;
+static unsigned long entries_hash;
+static bool entries_valid;
+
+/* the tags and attributes of the last tree listed */
+static struct list tags;
+static struct tree *tags_tree;
+static unsigned long tags_hash;
+static bool tags_valid;
+static struct list joined;
+
+/* complete a path from the listing of its directory */
+long match_files(const char *prefix, int len, char ***matches)
+{
+	char dir[MAXLEN + 1], path[2 * MAXLEN + 2];
+	struct dirent *d;
+	struct stat st;
+	time_t mtime;
+	bool hidden;
+	DIR *dp;
+	int dirlen;
+
+	for (dirlen = len; dirlen > 0 && prefix[dirlen-1] != '/'; dirlen--)
+		;
+	memcpy(dir, prefix, dirlen);
+	dir[dirlen] = '\0';
+	hidden = dirlen < len && prefix[dirlen] == '.';
+	if (stat(dirlen > 0 ? dir : ".", &st) != 0)
+		return 0;
+	mtime = st.st_mtime;
+
+	/* typing more only narrows the range in the list already made */
+	if (!files_valid || strcmp(dir, files_dir) != 0
+			|| mtime != files_mtime || hidden != files_hidden) {
+		files_valid = false;
+		list_clear(&files);
+		if ((dp = opendir(dirlen > 0 ? dir : ".")) == NULL)
+			return 0;
+		while ((d = readdir(dp)) != NULL) {
+			if (strcmp(d->d_name, ".") == 0
+					|| strcmp(d->d_name, "..") == 0
+					|| (d->d_name[0] == '.' && !hidden)
+					|| dirlen + strlen(d->d_name) >= MAXLEN)
+				continue;
+			sprintf(path, "%s%s", dir, d->d_name);
+			list_add(&files, path, strlen(path),
+					stat(path, &st) == 0 && S_ISDIR(st.st_mode)
+					? "/" : "");
+		}
+		closedir(dp);
+		list_sort(&files);
+		strcpy(files_dir, dir);
+		files_mtime = mtime;
+		files_hidden = hidden;
+		files_valid = true;
+	}
+	return list_match(&files, prefix, len, matches);
+}
+
+/* complete the text of an entry below t */
+long match_entries(struct tree *t, const char *prefix, int len,
+		char ***matches)
+{
+	unsigned long hash = tree_hash(t);
+	if (!entries_valid || t != entries_tree || hash != entries_hash) {
+		list_clear(&entries);
+		/* the block is made big enough for all the text at once */
+		entries.size = t->tbytes + t->ndesc + 1;
+		entries.text = malloc(entries.size);
+		add_entries(&entries, t);
+		list_sort(&entries);
+		entries_tree = t;
+		entries_hash = hash;
+		entries_valid = true;
+	}
+	return list_match(&entries, prefix, len, matches);
+}
+
+/* complete a tag or attribute in t's tree */
+long match_tags(struct tree *t, const char *prefix, int len, char ***matches)
+{
+	unsigned long hash = tree_hash(t);
+	char **names;
+	long i, k, n;
+
+	/* only the last word of a query is completed */
+	for (i = len; i > 0 && prefix[i-1] != ' '; i--)
+		;
+	if (!tags_valid || t != tags_tree || hash != tags_hash) {
+		list_clear(&tags);
+		n = tag_names(t, &names);
+		for (k = 0; k < n; k++) {
+			list_add(&tags, names[k], strlen(names[k]), "");
+		}
+		list_sort(&tags);
+		tags_tree = t;
+		tags_hash = hash;
+		tags_valid = true;
+	}
+	n = list_match(&tags, &prefix[i], len - i, matches);
+	if (i == 0 || n == 0)
+		return n;
+	/* the matches are put after the words before the last */
+	list_clear(&joined);
+	for (k = 0; k < n; k++) {
+		list_add(&joined, prefix, i, (*matches)[k]);
+	}
+	list_sort(&joined);
+	*matches = joined.item;
+	return joined.n;
+}
+
+/* add the text of everything below t */
+static void add_entries(struct list *l, struct tree *t)
+{
+	int i;
+	for (i = 0; i < t->nchild; i++) {
+		list_add(l, t->child[i]->text, strlen(t->child[i]->text), "");
+		add_entries(l, t->child[i]);
+	}
+}
+
+/* empty the list */
+static void list_clear(struct list *l)
+{
+	free(l->item);
+	free(l->text);
+	memset(l, 0, sizeof(*l));
+}
+
+/* add n chars of s followed by suffix */
+static void list_add(struct list *l, const char *s, size_t n,
+		const char *suffix)
+{
+	size_t need = n + strlen(suffix) + 1;
+	if (l->used + need > l->size) {
+		l->size = l->size == 0 ? 4096 : l->size * 2;
+		if (l->size < l->used + need)
+			l->size = l->used + need;
+		l->text = realloc(l->text, l->size);
+	}
+	l->n++;
+	memcpy(&l->text[l->used], s, n);
+	strcpy(&l->text[l->used + n], suffix);
+	l->used += need;
+}
+
+/* point at each string in the block, sort them and drop repeats */
+static void list_sort(struct list *l)
+{
+	struct keyed *k = malloc(sizeof(*k) * (l->n + 1));
+	char *s = l->text;
+	long i, n = 0;
+	size_t j;
+
+	for (i = 0; i < l->n; i++) {
+		k[i].s = s;
+		k[i].key = 0;
+		for (j = 0; j < sizeof(k[i].key); j++) {
+			k[i].key <<= 8;
+			if (*s != '\0')
+				k[i].key |= (unsigned char)*s++;
+		}
+		s += strlen(s) + 1;
+	}
+	sort_keyed(k, l->n);
+	l->item = malloc(sizeof(*l->item) * (l->n + 1));
+	for (i = 0; i < l->n; i++) {
+		if (n == 0 || strcmp(k[i].s, l->item[n-1]) != 0)
+			l->item[n++] = k[i].s;
+	}
+	l->n = n;
+	free(k);
+}
+
+/* point *matches at the items starting with the len chars of prefix and
+   return how many there are */
+static long list_match(struct list *l, const char *prefix, int len,
+		char ***matches)
+{
+	long lo = 0, hi = l->n, mid, first;
+	/* the first item not before the prefix */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strncmp(l->item[mid], prefix, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	first = lo;
+	/* the first item after everything starting with it */
+	hi = l->n;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (strncmp(l->item[mid], prefix, len) == 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*matches = &l->item[first];
+	return lo - first;
+}
+
+/* sort keyed strings into strcmp order: a radix sort on the keys, then
+   the text within each run of equal keys */
+static void sort_keyed(struct keyed *k, long n)
+{
+	struct keyed *tmp = malloc(sizeof(*tmp) * (n + 1)), *src = k, *dst = tmp;
+	long count[256], i, j, sum;
+	unsigned shift;
+
+	for (shift = 0; shift < 8 * sizeof(k->key); shift += 8) {
+		memset(count, 0, sizeof(count));
+		for (i = 0; i < n; i++) {
+			count[(src[i].key >> shift) & 0xff]++;
+		}
+		/* a byte that's the same everywhere doesn't need a pass */
+		if (n == 0 || count[(src[0].key >> shift) & 0xff] == n)
+			continue;
+		for (i = sum = 0; i < 256; i++) {
+			sum += count[i];
+			count[i] = sum - count[i];
+		}
+		for (i = 0; i < n; i++) {
+			dst[count[(src[i].key >> shift) & 0xff]++] = src[i];
+		}
+		dst = src;
+		src = src == k ? tmp : k;
+	}
+	if (src != k)
+		memcpy(k, src, sizeof(*k) * n);
+	free(tmp);
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; j < n && k[j].key == k[i].key; j++)
+			;
+		if (j - i > 1)
+			qsort(&k[i], j - i, sizeof(*k), cmp_keyed);
+	}
+}
+
+/* order keyed strings as strcmp would, for qsort */
+static int cmp_keyed(const void *a, const void *b)
+{
+	const struct keyed *ka = a, *kb = b;
+	if (ka->key != kb->key)
+		return ka->key < kb->key ? -1 : 1;
+	return strcmp(ka->s, kb->s);
+}
@@ -0,0 +1,24 @@
+#ifndef TT_COMPLETE_H
+#define TT_COMPLETE_H
+
+#include "readline.h"
+#include "tree.h"
+
+/* Tab completion sources. Each keeps its candidates in a sorted list that
+   is only rebuilt when what it lists changes, so each Tab is two binary
+   searches for the range that starts with what was typed */
+
+/* complete a path from the listing of its directory, directories ending
+   in '/'. Hidden files are listed once a '.' is typed */
+long match_files(const char *prefix, int len, char ***matches);
+
+/* complete the text of an entry below t. The list is rebuilt when t's
+   hash changes */
+long match_entries(struct tree *t, const char *prefix, int len,
+		char ***matches);
+
+/* complete the last word of a tag query from the tags and attributes in
+   t's tree */
+long match_tags(struct tree *t, const char *prefix, int len, char ***matches);
+
+#endif /* TT_COMPLETE_H */
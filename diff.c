@@ -0,0 +1,389 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "diff.h"
+
+/* A child keyed for matching against the children of another entry */
+struct key {
+	unsigned long hash;  /* of the text */
+	int dup;             /* earlier siblings with the same text */
+	int index;           /* position among its siblings */
+	struct tree *t;
+};
+
+/* Where a diff is being written */
+struct diff_out {
+	FILE *f;
+	struct tree **path;  /* the entries leading to the current depth */
+	int alloc;
+	int printed;         /* how many of path have been written */
+	long changes;
+};
+
+/* static prototypes */
+static int by_dup(const void *a, const void *b);
+static int by_position(const void *a, const void *b);
+static void diff_node(struct diff_out *out, struct tree *a, struct tree *b,
+		int depth);
+static void drop_children(struct tree *t);
+static int *invert(const int *m, int nb, int na);
+static struct key *key_children(const struct tree *t);
+static void mark_conflict(struct tree *t, long *conflicts);
+static int *match(const struct tree *a, const struct tree *b);
+static void merge_node(struct tree *b, struct tree *o, struct tree *t,
+		long *conflicts);
+static void put_context(struct diff_out *out, int depth);
+static void put_line(FILE *f, int depth, const char *mark, const char *text);
+static void put_subtree(struct diff_out *out, struct tree *t, int depth,
+		const char *mark);
+static void put_marked(FILE *f, struct tree *t, int depth, const char *mark);
+static void take_children(struct tree *o, struct tree *t);
+
+/* write the changes that turn the children of a into those of b to f,
+   returning the number of entries added or removed */
+long diff_trees(struct tree *a, struct tree *b, FILE *f)
+{
+	struct diff_out out;
+	memset(&out, 0, sizeof(out));
+	out.f = f;
+	diff_node(&out, a, b, 0);
+	free(out.path);
+	return out.changes;
+}
+
+/* merge the changes made from base to theirs into ours */
+long merge_trees(struct tree *base, struct tree *ours, struct tree *theirs)
+{
+	long conflicts = 0;
+	merge_node(base, ours, theirs, &conflicts);
+	return conflicts;
+}
+
+/* true if a and b have the same text and children, recursively. The
+   hashes turn away nearly every difference without a walk, but equal
+   hashes can still collide, so a match is checked entry by entry */
+bool same_tree(struct tree *a, struct tree *b)
+{
+	int i;
+	if (a->ndesc != b->ndesc || a->nchild != b->nchild
+			|| tree_hash(a) != tree_hash(b)
+			|| strcmp(a->text, b->text) != 0)
+		return false;
+	for (i = 0; i < a->nchild; i++) {
+		if (!same_tree(a->child[i], b->child[i]))
+			return false;
+	}
+	return true;
+}
+
+/* Write the differences between the children of a and b, which are at
+   depth. b's children are written in order, each preceded by the
+   children of a before its partner that b no longer has */
+static void diff_node(struct diff_out *out, struct tree *a, struct tree *b,
+		int depth)
+{
+	int *m = match(a, b);
+	char *done = calloc(a->nchild + 1, 1);
+	int next = 0;
+	int i, j;
+
+	if (depth >= out->alloc) {
+		out->alloc = out->alloc == 0 ? 16 : out->alloc * 2;
+		out->path = realloc(out->path, sizeof(*out->path) * out->alloc);
+	}
+	for (j = 0; j < b->nchild; j++) {
+		if (m[j] >= 0)
+			done[m[j]] = 1;
+	}
+	for (j = 0; j < b->nchild; j++) {
+		if (m[j] < 0) {
+			put_subtree(out, b->child[j], depth, DIFF_ADD);
+			continue;
+		}
+		for (; next < m[j]; next++) {
+			if (!done[next]) {
+				put_subtree(out, a->child[next], depth, DIFF_DEL);
+				done[next] = 1;
+			}
+		}
+		if (next <= m[j])
+			next = m[j] + 1;
+		if (same_tree(a->child[m[j]], b->child[j]))
+			continue;
+		out->path[depth] = b->child[j];
+		if (out->printed > depth)
+			out->printed = depth;
+		diff_node(out, a->child[m[j]], b->child[j], depth + 1);
+	}
+	for (i = 0; i < a->nchild; i++) {
+		if (!done[i])
+			put_subtree(out, a->child[i], depth, DIFF_DEL);
+	}
+	free(done);
+	free(m);
+}
+
+/* Merge the children of o and t, whose common ancestor is b or NULL if
+   both sides added them. Children both sides still have are merged in
+   turn. A child one side deleted goes if the other left it unchanged,
+   and is kept as a conflict if not. Children only one side added are
+   kept, those from t following their nearest sibling in t that o also
+   has. The children of t end up moved into o or freed */
+static void merge_node(struct tree *b, struct tree *o, struct tree *t,
+		long *conflicts)
+{
+	int *ob, *tb, *to, *ot;
+	struct tree **old, **result;
+	char *wanted, *moved;
+	int nold = o->nchild;
+	int n = 0;
+	int i, j;
+
+	/* a side that left the subtree alone takes the other side's */
+	if (same_tree(o, t) || (b != NULL && same_tree(b, t))) {
+		drop_children(t);
+		return;
+	}
+	if (b != NULL && same_tree(b, o)) {
+		take_children(o, t);
+		return;
+	}
+	ob = match(b, o);
+	tb = match(b, t);
+	to = match(o, t);
+	ot = invert(to, t->nchild, o->nchild);
+	old = malloc(sizeof(*old) * (nold + 1));
+	result = malloc(sizeof(*result) * (nold + t->nchild + 1));
+	wanted = calloc(t->nchild + 1, 1);
+	moved = calloc(t->nchild + 1, 1);
+
+	/* which of t's children o doesn't have should be kept */
+	for (j = 0; j < t->nchild; j++) {
+		if (to[j] >= 0)
+			continue;
+		if (tb[j] < 0) {
+			wanted[j] = 1;
+		} else if (!same_tree(b->child[tb[j]], t->child[j])) {
+			mark_conflict(t->child[j], conflicts);
+			wanted[j] = 1;
+		}
+	}
+
+	for (j = 0; j < t->nchild && to[j] < 0; j++) {
+		if (wanted[j]) {
+			result[n++] = t->child[j];
+			moved[j] = 1;
+		}
+	}
+	memcpy(old, o->child, sizeof(*old) * nold);
+	for (i = 0; i < nold; i++) {
+		struct tree *c = old[i];
+		if (ot[i] >= 0) {
+			merge_node(ob[i] >= 0 ? b->child[ob[i]] : NULL, c,
+					t->child[ot[i]], conflicts);
+			result[n++] = c;
+			for (j = ot[i] + 1; j < t->nchild && to[j] < 0; j++) {
+				if (wanted[j] && !moved[j]) {
+					result[n++] = t->child[j];
+					moved[j] = 1;
+				}
+			}
+		} else if (ob[i] >= 0 && same_tree(b->child[ob[i]], c)) {
+			/* t deleted it and o left it alone */
+			continue;
+		} else {
+			if (ob[i] >= 0)
+				mark_conflict(c, conflicts);
+			result[n++] = c;
+		}
+	}
+	for (j = 0; j < t->nchild; j++) {
+		if (wanted[j] && !moved[j]) {
+			result[n++] = t->child[j];
+			moved[j] = 1;
+		}
+	}
+
+	set_children(o, result, n);
+	for (i = 0; i < nold; i++) {
+		if (old[i]->parent == NULL)
+			free_tree(old[i]);
+	}
+	/* the merged children of t have already given up theirs */
+	for (j = 0; j < t->nchild; j++) {
+		if (!moved[j])
+			free_tree(t->child[j]);
+	}
+	t->nchild = 0;
+
+	free(ob);
+	free(tb);
+	free(to);
+	free(ot);
+	free(old);
+	free(result);
+	free(wanted);
+	free(moved);
+}
+
+/* free t's children */
+static void drop_children(struct tree *t)
+{
+	int i;
+	for (i = 0; i < t->nchild; i++) {
+		free_tree(t->child[i]);
+	}
+	t->nchild = 0;
+}
+
+/* replace o's children with t's, freeing o's */
+static void take_children(struct tree *o, struct tree *t)
+{
+	struct tree **old = malloc(sizeof(*old) * (o->nchild + 1));
+	int nold = o->nchild;
+	int i;
+
+	memcpy(old, o->child, sizeof(*old) * nold);
+	set_children(o, t->child, t->nchild);
+	for (i = 0; i < nold; i++) {
+		free_tree(old[i]);
+	}
+	t->nchild = 0;
+	free(old);
+}
+
+/* prefix t's text with the conflict mark */
+static void mark_conflict(struct tree *t, long *conflicts)
+{
+	char *text = malloc(strlen(MERGE_CONFLICT) + strlen(t->text) + 1);
+	strcpy(text, MERGE_CONFLICT);
+	strcat(text, t->text);
+	set_text(t, text);
+	(*conflicts)++;
+}
+
+/* For each child of b, the index of the child of a it matches, or -1.
+   a may be NULL, matching nothing */
+static int *match(const struct tree *a, const struct tree *b)
+{
+	struct key *ka = key_children(a);
+	struct key *kb = key_children(b);
+	struct key *found;
+	int *m = malloc(sizeof(*m) * (b->nchild + 1));
+	int i;
+
+	for (i = 0; i < b->nchild; i++) {
+		m[i] = -1;
+	}
+	for (i = 0; ka != NULL && i < b->nchild; i++) {
+		found = bsearch(&kb[i], ka, a->nchild, sizeof(*ka), by_dup);
+		if (found != NULL)
+			m[kb[i].index] = found->index;
+	}
+	free(ka);
+	free(kb);
+	return m;
+}
+
+/* turn a match of b's children against a's around */
+static int *invert(const int *m, int nb, int na)
+{
+	int *inv = malloc(sizeof(*inv) * (na + 1));
+	int i;
+	for (i = 0; i < na; i++) {
+		inv[i] = -1;
+	}
+	for (i = 0; i < nb; i++) {
+		if (m[i] >= 0)
+			inv[m[i]] = i;
+	}
+	return inv;
+}
+
+/* key t's children, sorted so they can be searched with by_dup. Returns
+   NULL if t is NULL or has no children */
+static struct key *key_children(const struct tree *t)
+{
+	struct key *k;
+	int i;
+
+	if (t == NULL || t->nchild == 0)
+		return NULL;
+	k = malloc(sizeof(*k) * t->nchild);
+	for (i = 0; i < t->nchild; i++) {
+		k[i].hash = hash_text(t->child[i]->text);
+		k[i].index = i;
+		k[i].t = t->child[i];
+	}
+	qsort(k, t->nchild, sizeof(*k), by_position);
+	for (i = 0; i < t->nchild; i++) {
+		k[i].dup = i > 0 && k[i-1].hash == k[i].hash
+			&& strcmp(k[i-1].t->text, k[i].t->text) == 0
+			? k[i-1].dup + 1 : 0;
+	}
+	return k;
+}
+
+/* order keys by text, then position, so equal texts get increasing dups */
+static int by_position(const void *a, const void *b)
+{
+	const struct key *ka = a;
+	const struct key *kb = b;
+	int d;
+	if (ka->hash != kb->hash)
+		return ka->hash < kb->hash ? -1 : 1;
+	if ((d = strcmp(ka->t->text, kb->t->text)) != 0)
+		return d;
+	return ka->index - kb->index;
+}
+
+/* the same order, compared by dup so keys on both sides can meet */
+static int by_dup(const void *a, const void *b)
+{
+	const struct key *ka = a;
+	const struct key *kb = b;
+	int d;
+	if (ka->hash != kb->hash)
+		return ka->hash < kb->hash ? -1 : 1;
+	if ((d = strcmp(ka->t->text, kb->t->text)) != 0)
+		return d;
+	return ka->dup - kb->dup;
+}
+
+/* write the context leading to depth that hasn't been written yet */
+static void put_context(struct diff_out *out, int depth)
+{
+	for (; out->printed < depth; out->printed++) {
+		put_line(out->f, out->printed, "",
+				out->path[out->printed]->text);
+	}
+}
+
+/* write t and its descendants at depth with mark, after its context */
+static void put_subtree(struct diff_out *out, struct tree *t, int depth,
+		const char *mark)
+{
+	put_context(out, depth);
+	put_marked(out->f, t, depth, mark);
+	out->changes += t->ndesc + 1;
+}
+
+static void put_marked(FILE *f, struct tree *t, int depth, const char *mark)
+{
+	int i;
+	put_line(f, depth, mark, t->text);
+	for (i = 0; i < t->nchild; i++) {
+		put_marked(f, t->child[i], depth + 1, mark);
+	}
+}
+
+static void put_line(FILE *f, int depth, const char *mark, const char *text)
+{
+	int i;
+	for (i = 0; i < depth; i++) {
+		putc('\t', f);
+	}
+	fputs(mark, f);
+	fputs(text, f);
+	putc('\n', f);
+}
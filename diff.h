@@ -0,0 +1,34 @@
+#ifndef TT_DIFF_H
+#define TT_DIFF_H
+
+#include <stdio.h>
+
+#include "tree.h"
+
+/* Marks on the entries of a diff or merge. A diff is itself a tree file:
+   entries only in the old tree are prefixed with DIFF_DEL, entries only
+   in the new one with DIFF_ADD, and the unchanged entries leading to a
+   change are kept as they are for context */
+#define DIFF_ADD "+ "
+#define DIFF_DEL "- "
+#define MERGE_CONFLICT "! "
+
+/* Entries are matched by their path: two entries match if their parents
+   match and they have the same text, the nth entry with a given text
+   among its siblings matching the nth on the other side. */
+
+/* write the changes that turn the children of a into those of b to f,
+   returning the number of entries added or removed */
+long diff_trees(struct tree *a, struct tree *b, FILE *f);
+
+/* merge the changes made from base to theirs into ours, consuming theirs
+   and leaving base alone. An entry changed on one side and deleted on the
+   other is kept with its text prefixed by MERGE_CONFLICT. Returns the
+   number of conflicts */
+long merge_trees(struct tree *base, struct tree *ours, struct tree *theirs);
+
+/* true if a and b have the same text and children, recursively, going
+   by their cached hashes */
+bool same_tree(struct tree *a, struct tree *b);
+
+#endif /* TT_DIFF_H */
@@ -0,0 +1,882 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "export.h"
+
+/* longest line or string read before the rest is dropped; entries are
+   cut to MAX_ENTRY_LEN afterwards, so this only needs some slack for
+   escapes and markup */
+#define IMPORT_BUFSIZE (MAX_ENTRY_LEN * 4)
+
+/* deepest nesting of JSON objects and arrays read. Each level is a call,
+   so a short file of brackets would otherwise overflow the stack */
+#define JSON_MAX_DEPTH 10000
+
+/* The entries open while an importer reads, by depth. open[0] is the
+   parent everything is read into */
+struct builder {
+	struct tree **open;
+	int nopen;
+	int alloc;
+};
+
+/* A JSON or OPML file being read a character at a time */
+struct scanner {
+	struct reader *rd;  /* line and column of the next character */
+	FILE *f;
+	int c;              /* the next character, or EOF */
+	int depth;          /* JSON objects and arrays open */
+	char text[IMPORT_BUFSIZE];  /* an entry's text, for every level */
+};
+
+/* static prototypes */
+#define X(a, b, c, d, e) \
+	static void e##_begin(struct writer *w); \
+	static void e##_put(struct writer *w, int depth, const char *text); \
+	static void e##_end(struct writer *w); \
+	static enum errcode e##_read(struct reader *rd, struct tree *parent);
+#include "exports.h"
+static struct tree *add_entry(struct builder *b, int depth, char *text);
+static void advance(struct scanner *s);
+static void clean_text(char *text);
+static void export_node(struct writer *w, struct tree *t, int depth);
+static int json_hex(struct scanner *s);
+static enum errcode json_object(struct scanner *s, struct tree *parent);
+static enum errcode json_record(struct scanner *s, struct tree **node,
+		long count, struct tree *parent);
+static enum errcode json_skip(struct scanner *s);
+static enum errcode json_string(struct scanner *s, char *buf, int size);
+static void put_json(FILE *f, const char *text);
+static void put_xml(FILE *f, const char *text);
+static void put_utf8(char *buf, int *n, int size, unsigned long c);
+static void skip_space(struct scanner *s);
+static void xml_attr(const char *tag, const char *name, char *buf, int size);
+
+const struct exporter exporters[] = {
+#define X(a, b, c, d, e) { b, c, d },
+#include "exports.h"
+};
+
+/* the functions of each format, in the order of exporters */
+static const struct {
+	void (*begin)(struct writer *w);
+	void (*put)(struct writer *w, int depth, const char *text);
+	void (*end)(struct writer *w);
+	enum errcode (*read)(struct reader *rd, struct tree *parent);
+} formats[] = {
+#define X(a, b, c, d, e) { e##_begin, e##_put, e##_end, e##_read },
+#include "exports.h"
+};
+
+/******************************************************************************
+	Writing
+*/
+
+/* start writing fmt to f */
+void writer_begin(struct writer *w, FILE *f, enum export_format fmt)
+{
+	memset(w, 0, sizeof(*w));
+	w->f = f;
+	w->fmt = fmt;
+	w->depth = -1;
+	formats[fmt].begin(w);
+}
+
+/* write an entry at depth, at most one deeper than the last */
+void writer_entry(struct writer *w, int depth, const char *text)
+{
+	if (depth > w->depth + 1)
+		depth = w->depth + 1;
+	formats[w->fmt].put(w, depth, text);
+	w->depth = depth;
+	w->count++;
+}
+
+/* close anything still open and release the writer */
+void writer_end(struct writer *w)
+{
+	formats[w->fmt].end(w);
+	free(w->index);
+	w->index = NULL;
+}
+
+/* write the descendants of t to f, t's children at the top level */
+void export_tree(struct tree *t, FILE *f, enum export_format fmt)
+{
+	struct writer w;
+	int i;
+	writer_begin(&w, f, fmt);
+	for (i = 0; i < t->nchild; i++) {
+		export_node(&w, t->child[i], 0);
+	}
+	writer_end(&w);
+}
+
+static void export_node(struct writer *w, struct tree *t, int depth)
+{
+	int i;
+	writer_entry(w, depth, t->text);
+	for (i = 0; i < t->nchild; i++) {
+		export_node(w, t->child[i], depth + 1);
+	}
+}
+
+/* the format of a file going by its extension, EXPORT_TEXT if unknown */
+enum export_format format_of(const char *fname)
+{
+	enum export_format fmt = EXPORT_TEXT;
+	size_t len = strlen(fname);
+	size_t best = 0;
+	size_t n;
+	int i;
+
+	/* the longest match wins, so .flat.json isn't taken for .json */
+	for (i = 0; i < EXPORT_COUNT; i++) {
+		n = strlen(exporters[i].ext);
+		if (n > best && n < len
+				&& strcmp(fname + len - n, exporters[i].ext) == 0) {
+			fmt = i;
+			best = n;
+		}
+	}
+	return fmt;
+}
+
+/* look up a format by name, returning false if there's none */
+bool format_named(const char *name, enum export_format *fmt)
+{
+	int i;
+	for (i = 0; i < EXPORT_COUNT; i++) {
+		if (strcmp(name, exporters[i].name) == 0) {
+			*fmt = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* tab indented text, as write_tree writes it */
+static void text_begin(struct writer *w)
+{
+	(void)(w);
+}
+
+static void text_put(struct writer *w, int depth, const char *text)
+{
+	int i;
+	for (i = 0; i < depth; i++) {
+		putc('\t', w->f);
+	}
+	fputs(text, w->f);
+	putc('\n', w->f);
+}
+
+static void text_end(struct writer *w)
+{
+	(void)(w);
+}
+
+/* a list nested by two spaces a level */
+static void md_begin(struct writer *w)
+{
+	(void)(w);
+}
+
+static void md_put(struct writer *w, int depth, const char *text)
+{
+	int i;
+	for (i = 0; i < depth; i++) {
+		putc(' ', w->f);
+		putc(' ', w->f);
+	}
+	putc('-', w->f);
+	putc(' ', w->f);
+	fputs(text, w->f);
+	putc('\n', w->f);
+}
+
+static void md_end(struct writer *w)
+{
+	(void)(w);
+}
+
+/* [{"text":"a","children":[{"text":"b"}]}], one object per line. Each
+   object is left open until the next entry shows whether it has
+   children */
+static void json_begin(struct writer *w)
+{
+	putc('[', w->f);
+}
+
+static void json_put(struct writer *w, int depth, const char *text)
+{
+	int i;
+	if (depth > w->depth && w->depth >= 0) {
+		fputs(",\"children\":[", w->f);
+	} else if (w->depth >= 0) {
+		putc('}', w->f);
+		for (i = w->depth; i > depth; i--) {
+			fputs("]}", w->f);
+		}
+		putc(',', w->f);
+	}
+	fputs("\n{\"text\":", w->f);
+	put_json(w->f, text);
+}
+
+static void json_end(struct writer *w)
+{
+	int i;
+	if (w->depth >= 0) {
+		putc('}', w->f);
+		for (i = w->depth; i > 0; i--) {
+			fputs("]}", w->f);
+		}
+	}
+	fputs("\n]\n", w->f);
+}
+
+/* [[-1,"a"],[0,"b"]], where each entry's parent is the index of an
+   earlier one, or -1 at the top level */
+static void jsonflat_begin(struct writer *w)
+{
+	putc('[', w->f);
+}
+
+static void jsonflat_put(struct writer *w, int depth, const char *text)
+{
+	if (depth >= w->alloc) {
+		w->alloc = w->alloc == 0 ? 16 : w->alloc * 2;
+		w->index = realloc(w->index, sizeof(*w->index) * w->alloc);
+	}
+	w->index[depth] = w->count;
+	fprintf(w->f, "%s\n[%ld,", w->count > 0 ? "," : "",
+			depth > 0 ? w->index[depth-1] : -1L);
+	put_json(w->f, text);
+	putc(']', w->f);
+}
+
+static void jsonflat_end(struct writer *w)
+{
+	fputs("\n]\n", w->f);
+}
+
+/* <outline text="a"> elements, each left open until the next entry shows
+   whether it has children */
+static void opml_begin(struct writer *w)
+{
+	fputs("<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+			"<opml version=\"2.0\">\n<head></head>\n<body>\n", w->f);
+}
+
+static void opml_put(struct writer *w, int depth, const char *text)
+{
+	int i, j;
+	if (depth > w->depth && w->depth >= 0) {
+		fputs(">\n", w->f);
+	} else if (w->depth >= 0) {
+		fputs("/>\n", w->f);
+		for (i = w->depth; i > depth; i--) {
+			for (j = 0; j < i; j++) {
+				putc('\t', w->f);
+			}
+			fputs("</outline>\n", w->f);
+		}
+	}
+	for (i = 0; i <= depth; i++) {
+		putc('\t', w->f);
+	}
+	fputs("<outline text=\"", w->f);
+	put_xml(w->f, text);
+	putc('"', w->f);
+}
+
+static void opml_end(struct writer *w)
+{
+	int i, j;
+	if (w->depth >= 0) {
+		fputs("/>\n", w->f);
+		for (i = w->depth; i > 0; i--) {
+			for (j = 0; j < i; j++) {
+				putc('\t', w->f);
+			}
+			fputs("</outline>\n", w->f);
+		}
+	}
+	fputs("</body>\n</opml>\n", w->f);
+}
+
+/* write text as a JSON string, copying the runs between escapes whole */
+static void put_json(FILE *f, const char *text)
+{
+	const unsigned char *p = (const unsigned char *)text;
+	const unsigned char *run = p;
+	putc('"', f);
+	for (; *p != '\0'; p++) {
+		if (*p != '"' && *p != '\\' && *p >= 0x20)
+			continue;
+		fwrite(run, 1, p - run, f);
+		if (*p < 0x20)
+			fprintf(f, "\\u%04x", *p);
+		else {
+			putc('\\', f);
+			putc(*p, f);
+		}
+		run = p + 1;
+	}
+	fwrite(run, 1, p - run, f);
+	putc('"', f);
+}
+
+/* write text as an XML attribute value */
+static void put_xml(FILE *f, const char *text)
+{
+	const char *p = text;
+	const char *run = p;
+	for (; *p != '\0'; p++) {
+		const char *esc;
+		switch (*p) {
+		case '&': esc = "&amp;"; break;
+		case '<': esc = "&lt;"; break;
+		case '>': esc = "&gt;"; break;
+		case '"': esc = "&quot;"; break;
+		default: continue;
+		}
+		fwrite(run, 1, p - run, f);
+		fputs(esc, f);
+		run = p + 1;
+	}
+	fwrite(run, 1, p - run, f);
+}
+
+/******************************************************************************
+	Reading
+*/
+
+/* read fmt from f as children of parent, reporting errors through rd the
+   way read_forest does */
+enum errcode import_tree(struct reader *rd, FILE *f, enum export_format fmt,
+		struct tree *parent)
+{
+	if (fmt == EXPORT_TEXT) {
+		reader_init(rd, f);
+		return read_forest(rd, parent);
+	}
+	memset(rd, 0, sizeof(*rd));
+	rd->f = f;
+	rd->line = 1;
+	rd->select = -1;
+	return formats[fmt].read(rd, parent);
+}
+
+/* tab indented text is read by read_forest, see import_tree */
+static enum errcode text_read(struct reader *rd, struct tree *parent)
+{
+	reader_init(rd, rd->f);
+	return read_forest(rd, parent);
+}
+
+/* Markdown: list items nest by their indentation, the first indented
+   item deciding how many spaces make a level. Headings nest by their
+   level with the list items below them, and other lines are read as
+   items at the heading's level */
+static enum errcode md_read(struct reader *rd, struct tree *parent)
+{
+	char line[IMPORT_BUFSIZE];
+	struct builder b;
+	int width = 0;
+	int base = 0;
+	int spaces, depth, len, c;
+	char *p;
+
+	memset(&b, 0, sizeof(b));
+	add_entry(&b, -1, NULL);
+	b.open[0] = parent;
+	for (; fgets(line, sizeof(line), rd->f) != NULL; rd->line++) {
+		len = strlen(line);
+		if (len > 0 && line[len-1] != '\n') {
+			/* drop the rest of a long line */
+			while ((c = getc(rd->f)) != EOF && c != '\n')
+				;
+		}
+		spaces = 0;
+		for (p = line; *p == ' ' || *p == '\t'; p++) {
+			spaces += *p == '\t' ? 4 : 1;
+		}
+		if (*p == '\n' || *p == '\r' || *p == '\0')
+			continue;
+		if (*p == '#') {
+			for (depth = 0; *p == '#'; p++) {
+				depth++;
+			}
+			base = depth;
+			add_entry(&b, depth - 1, p);
+			continue;
+		}
+		depth = base;
+		if ((*p == '-' || *p == '*' || *p == '+') && p[1] == ' ') {
+			p += 2;
+		} else if (isdigit((unsigned char)*p)) {
+			char *q = p;
+			while (isdigit((unsigned char)*q))
+				q++;
+			if ((*q == '.' || *q == ')') && q[1] == ' ')
+				p = q + 2;
+		}
+		if (spaces > 0 && width == 0)
+			width = spaces;
+		if (width > 0)
+			depth += spaces / width;
+		add_entry(&b, depth, p);
+	}
+	free(b.open);
+	if (ferror(rd->f))
+		return reader_error(rd, ERR_IO, "read failed");
+	return ERR_NONE;
+}
+
+/* JSON: an array of {"text": ..., "children": [...]} objects, or of
+   [parent index, text] pairs as jsonflat writes. Other keys are skipped */
+static enum errcode json_read(struct reader *rd, struct tree *parent)
+{
+	struct scanner s;
+	struct tree **node = NULL;
+	long count = 0, alloc = 0;
+	enum errcode err = ERR_NONE;
+
+	s.rd = rd;
+	s.f = rd->f;
+	s.c = getc(s.f);
+	s.depth = 0;
+	skip_space(&s);
+	if (s.c != '[')
+		return reader_error(rd, ERR_FORMAT, "expected a JSON array");
+	advance(&s);
+	skip_space(&s);
+	while (err == ERR_NONE && s.c != ']') {
+		if (s.c == '{') {
+			err = json_object(&s, parent);
+		} else if (s.c == '[') {
+			if (count == alloc) {
+				alloc = alloc == 0 ? 1024 : alloc * 2;
+				node = realloc(node, sizeof(*node) * alloc);
+			}
+			err = json_record(&s, node, count++, parent);
+		} else {
+			err = reader_error(rd, ERR_FORMAT, "expected an entry");
+		}
+		skip_space(&s);
+		if (err == ERR_NONE && s.c == ',') {
+			advance(&s);
+			skip_space(&s);
+		} else if (err == ERR_NONE && s.c != ']') {
+			err = reader_error(rd, ERR_FORMAT, "expected ',' or ']'");
+		}
+	}
+	free(node);
+	return err;
+}
+
+/* read one {"text": ..., "children": [...]} object into parent */
+static enum errcode json_object(struct scanner *s, struct tree *parent)
+{
+	char key[16];
+	char *text = s->text;
+	struct tree *t;
+	enum errcode err = ERR_NONE;
+	char *copy;
+
+	if (s->depth == JSON_MAX_DEPTH)
+		return reader_error(s->rd, ERR_FORMAT, "nested too deeply");
+	s->depth++;
+	t = add_child(parent, "-");
+	advance(s);
+	skip_space(s);
+	while (err == ERR_NONE && s->c != '}') {
+		if ((err = json_string(s, key, sizeof(key))) != ERR_NONE)
+			break;
+		skip_space(s);
+		if (s->c != ':') {
+			err = reader_error(s->rd, ERR_FORMAT, "expected ':'");
+			break;
+		}
+		advance(s);
+		skip_space(s);
+		if (strcmp(key, "text") == 0 && s->c == '"') {
+			if ((err = json_string(s, text, sizeof(s->text)))
+					!= ERR_NONE)
+				break;
+			clean_text(text);
+			copy = malloc(strlen(text) + 1);
+			strcpy(copy, text);
+			set_text(t, copy);
+		} else if (strcmp(key, "children") == 0 && s->c == '[') {
+			advance(s);
+			skip_space(s);
+			while (err == ERR_NONE && s->c == '{') {
+				err = json_object(s, t);
+				skip_space(s);
+				if (s->c == ',') {
+					advance(s);
+					skip_space(s);
+				}
+			}
+			if (err == ERR_NONE && s->c != ']')
+				err = reader_error(s->rd, ERR_FORMAT, "expected ']'");
+			advance(s);
+		} else {
+			err = json_skip(s);
+		}
+		skip_space(s);
+		if (err == ERR_NONE && s->c == ',') {
+			advance(s);
+			skip_space(s);
+		} else if (err == ERR_NONE && s->c != '}') {
+			err = reader_error(s->rd, ERR_FORMAT, "expected ',' or '}'");
+		}
+	}
+	advance(s);
+	s->depth--;
+	return err;
+}
+
+/* read one [parent index, text] pair, the count'th, into node */
+static enum errcode json_record(struct scanner *s, struct tree **node,
+		long count, struct tree *parent)
+{
+	char text[IMPORT_BUFSIZE];
+	long index = 0;
+	bool negative = false;
+	enum errcode err;
+
+	advance(s);
+	skip_space(s);
+	if (s->c == '-') {
+		negative = true;
+		advance(s);
+	}
+	if (!isdigit(s->c))
+		return reader_error(s->rd, ERR_FORMAT, "expected a parent index");
+	while (isdigit(s->c)) {
+		index = index * 10 + (s->c - '0');
+		advance(s);
+	}
+	if (negative)
+		index = -index;
+	if (index >= count || index < -1)
+		return reader_error(s->rd, ERR_FORMAT, "no entry with that index");
+	skip_space(s);
+	if (s->c != ',')
+		return reader_error(s->rd, ERR_FORMAT, "expected ','");
+	advance(s);
+	skip_space(s);
+	if ((err = json_string(s, text, sizeof(text))) != ERR_NONE)
+		return err;
+	skip_space(s);
+	if (s->c != ']')
+		return reader_error(s->rd, ERR_FORMAT, "expected ']'");
+	advance(s);
+	clean_text(text);
+	node[count] = add_child(index < 0 ? parent : node[index], text);
+	return ERR_NONE;
+}
+
+/* read a JSON string into buf, dropping what doesn't fit */
+static enum errcode json_string(struct scanner *s, char *buf, int size)
+{
+	unsigned long c, low;
+	int n = 0;
+
+	if (s->c != '"')
+		return reader_error(s->rd, ERR_FORMAT, "expected a string");
+	advance(s);
+	while (s->c != '"') {
+		if (s->c == EOF)
+			return reader_error(s->rd, ERR_FORMAT, "unterminated string");
+		c = s->c;
+		advance(s);
+		if (c == '\\') {
+			c = s->c;
+			advance(s);
+			switch (c) {
+			case 'b': case 'f': case 'n': case 'r': case 't':
+				c = ' ';
+				break;
+			case 'u':
+				c = json_hex(s);
+				/* a surrogate pair spells one character */
+				if (c >= 0xd800 && c < 0xdc00 && s->c == '\\') {
+					advance(s);
+					advance(s);
+					low = json_hex(s);
+					c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+				}
+				put_utf8(buf, &n, size, c);
+				continue;
+			}
+		}
+		if (n < size - 1)
+			buf[n++] = c;
+	}
+	advance(s);
+	buf[n] = '\0';
+	return ERR_NONE;
+}
+
+/* read the four hex digits of a \u escape */
+static int json_hex(struct scanner *s)
+{
+	int c = 0, i;
+	for (i = 0; i < 4 && isxdigit(s->c); i++) {
+		c = c * 16 + (isdigit(s->c) ? s->c - '0'
+				: tolower(s->c) - 'a' + 10);
+		advance(s);
+	}
+	return c;
+}
+
+/* skip a JSON value of any kind */
+static enum errcode json_skip(struct scanner *s)
+{
+	char scratch[4];
+	enum errcode err = ERR_NONE;
+	int close;
+
+	if (s->c == '"')
+		return json_string(s, scratch, sizeof(scratch));
+	if (s->c != '[' && s->c != '{') {
+		while (s->c != EOF && s->c != ',' && s->c != '}' && s->c != ']')
+			advance(s);
+		return ERR_NONE;
+	}
+	if (s->depth == JSON_MAX_DEPTH)
+		return reader_error(s->rd, ERR_FORMAT, "nested too deeply");
+	s->depth++;
+	close = s->c == '[' ? ']' : '}';
+	advance(s);
+	skip_space(s);
+	while (err == ERR_NONE && s->c != close) {
+		if (s->c == EOF)
+			return reader_error(s->rd, ERR_FORMAT, "unexpected end");
+		if (s->c == ',' || s->c == ':')
+			advance(s);
+		else
+			err = json_skip(s);
+		skip_space(s);
+	}
+	advance(s);
+	s->depth--;
+	return err;
+}
+
+/* OPML: each <outline> element is an entry, with its text attribute as
+   the text and the elements inside it as children */
+static enum errcode opml_read(struct reader *rd, struct tree *parent)
+{
+	char tag[IMPORT_BUFSIZE];
+	char text[IMPORT_BUFSIZE];
+	struct scanner s;
+	struct builder b;
+	int n, quote;
+
+	memset(&b, 0, sizeof(b));
+	add_entry(&b, -1, NULL);
+	b.open[0] = parent;
+	s.rd = rd;
+	s.f = rd->f;
+	s.c = getc(s.f);
+	for (;;) {
+		while (s.c != '<' && s.c != EOF)
+			advance(&s);
+		if (s.c == EOF)
+			break;
+		advance(&s);
+		/* read the tag up to its closing '>', minding quoted values */
+		for (n = 0, quote = 0; s.c != EOF && (quote || s.c != '>');
+				advance(&s)) {
+			if (quote == s.c)
+				quote = 0;
+			else if (!quote && (s.c == '"' || s.c == '\''))
+				quote = s.c;
+			if (n < (int)sizeof(tag) - 1)
+				tag[n++] = s.c;
+		}
+		tag[n] = '\0';
+		advance(&s);
+		if (strncmp(tag, "/outline", 8) == 0) {
+			if (b.nopen > 1)
+				b.nopen--;
+		} else if (strncmp(tag, "outline", 7) == 0
+				&& (isspace((unsigned char)tag[7]) || tag[7] == '/'
+					|| tag[7] == '\0')) {
+			xml_attr(tag + 7, "text", text, sizeof(text));
+			add_entry(&b, b.nopen - 1, text);
+			/* a self-closing element has no children */
+			if (n > 0 && tag[n-1] == '/')
+				b.nopen--;
+		}
+	}
+	free(b.open);
+	if (ferror(rd->f))
+		return reader_error(rd, ERR_IO, "read failed");
+	return ERR_NONE;
+}
+
+/* the value of attribute name in tag with entities replaced, or "" */
+static void xml_attr(const char *tag, const char *name, char *buf, int size)
+{
+	static const char *entity[][2] = {
+		{ "amp;", "&" }, { "lt;", "<" }, { "gt;", ">" },
+		{ "quot;", "\"" }, { "apos;", "'" }
+	};
+	size_t len = strlen(name);
+	const char *p = tag;
+	char quote;
+	int n = 0;
+	unsigned int i;
+
+	buf[0] = '\0';
+	for (;;) {
+		p = strstr(p, name);
+		if (p == NULL)
+			return;
+		if (isspace((unsigned char)p[-1]) && p[len] == '=')
+			break;
+		p += len;
+	}
+	p += len + 1;
+	quote = *p++;
+	for (; *p != '\0' && *p != quote; p++) {
+		if (*p != '&') {
+			if (n < size - 1)
+				buf[n++] = *p;
+			continue;
+		}
+		if (p[1] == '#') {
+			unsigned long c = p[2] == 'x' ? strtoul(p + 3, NULL, 16)
+				: strtoul(p + 2, NULL, 10);
+			put_utf8(buf, &n, size, c);
+			p = strchr(p, ';') != NULL ? strchr(p, ';') : p;
+			continue;
+		}
+		for (i = 0; i < sizeof(entity) / sizeof(entity[0]); i++) {
+			if (strncmp(p + 1, entity[i][0], strlen(entity[i][0])) == 0)
+				break;
+		}
+		if (i < sizeof(entity) / sizeof(entity[0])) {
+			if (n < size - 1)
+				buf[n++] = entity[i][1][0];
+			p += strlen(entity[i][0]);
+		} else if (n < size - 1) {
+			buf[n++] = '&';
+		}
+	}
+	buf[n] = '\0';
+}
+
+/* jsonflat is read by json_read, which tells the two apart */
+static enum errcode jsonflat_read(struct reader *rd, struct tree *parent)
+{
+	return json_read(rd, parent);
+}
+
+/* Add an entry with text at depth, or as deep as the open entries allow,
+   making it the last open entry. With depth -1 only make room */
+static struct tree *add_entry(struct builder *b, int depth, char *text)
+{
+	if (b->nopen + 1 >= b->alloc) {
+		b->alloc = b->alloc == 0 ? 16 : b->alloc * 2;
+		b->open = realloc(b->open, sizeof(*b->open) * b->alloc);
+	}
+	if (depth < 0) {
+		b->nopen = 1;
+		return NULL;
+	}
+	if (depth > b->nopen - 1)
+		depth = b->nopen - 1;
+	clean_text(text);
+	b->open[depth+1] = add_child(b->open[depth], text);
+	b->nopen = depth + 2;
+	return b->open[depth+1];
+}
+
+/* Put text on one line without surrounding space and cut it to fit an
+   entry, keeping whole UTF-8 characters. Empty text becomes "-", since a
+   blank line isn't an entry in a tree file */
+static void clean_text(char *text)
+{
+	char *p, *start;
+	size_t len;
+
+	for (p = text; *p != '\0'; p++) {
+		if ((unsigned char)*p < 0x20)
+			*p = ' ';
+	}
+	for (start = text; *start == ' '; start++)
+		;
+	len = strlen(start);
+	if (len > MAX_ENTRY_LEN - 1) {
+		len = MAX_ENTRY_LEN - 1;
+		while (len > 0 && ((unsigned char)start[len] & 0xc0) == 0x80)
+			len--;
+	}
+	while (len > 0 && start[len-1] == ' ')
+		len--;
+	memmove(text, start, len);
+	text[len] = '\0';
+	if (len == 0)
+		strcpy(text, "-");
+}
+
+/* append c to buf as UTF-8 if it fits */
+static void put_utf8(char *buf, int *n, int size, unsigned long c)
+{
+	char enc[4];
+	int len, i;
+
+	if (c < 0x80) {
+		enc[0] = c;
+		len = 1;
+	} else if (c < 0x800) {
+		enc[0] = 0xc0 | (c >> 6);
+		enc[1] = 0x80 | (c & 0x3f);
+		len = 2;
+	} else if (c < 0x10000) {
+		enc[0] = 0xe0 | (c >> 12);
+		enc[1] = 0x80 | ((c >> 6) & 0x3f);
+		enc[2] = 0x80 | (c & 0x3f);
+		len = 3;
+	} else {
+		enc[0] = 0xf0 | ((c >> 18) & 0x07);
+		enc[1] = 0x80 | ((c >> 12) & 0x3f);
+		enc[2] = 0x80 | ((c >> 6) & 0x3f);
+		enc[3] = 0x80 | (c & 0x3f);
+		len = 4;
+	}
+	if (*n + len > size - 1)
+		return;
+	for (i = 0; i < len; i++) {
+		buf[(*n)++] = enc[i];
+	}
+}
+
+/* move to the next character, counting lines and columns */
+static void advance(struct scanner *s)
+{
+	if (s->c == EOF)
+		return;
+	if (s->c == '\n') {
+		s->rd->line++;
+		s->rd->indent = 0;
+	} else {
+		s->rd->indent++;
+	}
+	s->c = getc(s->f);
+}
+
+static void skip_space(struct scanner *s)
+{
+	while (s->c != EOF && isspace(s->c))
+		advance(s);
+}
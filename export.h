@@ -0,0 +1,62 @@
+#ifndef TT_EXPORT_H
+#define TT_EXPORT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "tree.h"
+
+/* the file formats a tree can be written to and read from */
+enum export_format {
+#define X(a, b, c, d, e) EXPORT_##a,
+#include "exports.h"
+	EXPORT_COUNT
+};
+
+/* A file format's name, extension and description */
+struct exporter {
+	const char *name;
+	const char *ext;
+	const char *desc;
+};
+
+extern const struct exporter exporters[];
+
+/* Streams entries to a file. Entries are given in preorder with their
+   depth, and a writer only remembers the path to the last one, so any
+   size of tree is written through the stdio buffer without allocating
+   per entry */
+struct writer {
+	FILE *f;
+	enum export_format fmt;
+	int depth;      /* depth of the last entry, -1 before the first */
+	long count;     /* entries written */
+	long *index;    /* count of the last entry at each depth */
+	int alloc;
+};
+
+/* start writing fmt to f */
+void writer_begin(struct writer *w, FILE *f, enum export_format fmt);
+
+/* write an entry at depth, at most one deeper than the last */
+void writer_entry(struct writer *w, int depth, const char *text);
+
+/* close anything still open and release the writer */
+void writer_end(struct writer *w);
+
+/* write the descendants of t to f, t's children at the top level */
+void export_tree(struct tree *t, FILE *f, enum export_format fmt);
+
+/* read fmt from f as children of parent, reporting errors through rd the
+   way read_forest does. Each entry's text is put on one line and cut to
+   MAX_ENTRY_LEN */
+enum errcode import_tree(struct reader *rd, FILE *f, enum export_format fmt,
+		struct tree *parent);
+
+/* the format of a file going by its extension, EXPORT_TEXT if unknown */
+enum export_format format_of(const char *fname);
+
+/* look up a format by name, returning false if there's none */
+bool format_named(const char *name, enum export_format *fmt);
+
+#endif /* TT_EXPORT_H */
@@ -0,0 +1,18 @@
+#ifndef X
+#error  "To use this file, define X as a function-like macro " \
+	"with five arguments, then include this. The arguments are the " \
+	"enum constant, the name used on the command line, the file " \
+	"extension, a description, and the prefix of the functions that " \
+	"write the format (_begin, _put, _end) and read it (_read). "
+#endif
+
+/* enum     name        extension     description            functions */
+
+X( TEXT,     "text",     ".txt",       "tab indented text",   text     )
+X( MD,       "md",       ".md",        "nested Markdown list", md      )
+X( JSON,     "json",     ".json",      "nested JSON objects", json     )
+X( JSONFLAT, "jsonflat", ".flat.json", "JSON array of [parent index, "
+		"text] pairs",                                        jsonflat )
+X( OPML,     "opml",     ".opml",      "OPML outline",        opml     )
+
+#undef X
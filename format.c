@@ -0,0 +1,210 @@
+#include <string.h>
+
+#include "format.h"
+
+/* size of the input and output buffers. Lines longer than this are
+   handled in pieces, so memory use doesn't depend on the input */
+#define FMT_BUFSIZE (1 << 20)
+
+/* State carried from one line to the next */
+struct fmt_state {
+	const struct fmt_options *opt;
+	struct fmt_result *res;
+	FILE *out;
+	char delim;  /* indent character, '\0' until the first indent */
+	int width;   /* spaces per level, decided by the first indent */
+	int prev;    /* depth of the previous line */
+};
+
+static char ibuf[FMT_BUFSIZE];
+static char obuf[FMT_BUFSIZE];
+static size_t olen;
+
+/* static prototypes */
+static enum errcode fail(struct fmt_state *st, int column, const char *msg);
+static enum errcode flush(struct fmt_state *st);
+static enum errcode line_start(struct fmt_state *st, const char **s,
+		const char *e);
+static enum errcode put(struct fmt_state *st, const char *s, size_t n);
+static enum errcode put_indent(struct fmt_state *st, char c, size_t n);
+static const char *trim_end(const char *s, const char *e);
+
+/* validate and optionally rewrite a tree file one buffer at a time */
+enum errcode format_stream(FILE *in, FILE *out,
+		const struct fmt_options *opt, struct fmt_result *res)
+{
+	struct fmt_state st;
+	enum errcode err;
+	size_t len = 0;   /* bytes in ibuf */
+	size_t pos = 0;   /* start of the unprocessed bytes in ibuf */
+	size_t n;
+	const char *s, *e, *t;
+	bool cont = false; /* ibuf starts in the middle of a line */
+	bool eof = false;
+
+	memset(res, 0, sizeof(*res));
+	memset(&st, 0, sizeof(st));
+	st.opt = opt;
+	st.res = res;
+	st.out = out;
+	st.prev = -1;
+	olen = 0;
+
+	for (;;) {
+		s = ibuf + pos;
+		e = memchr(s, '\n', len - pos);
+		if (e == NULL && !eof) {
+			if (pos == 0 && len == FMT_BUFSIZE) {
+				/* the line doesn't fit: write what we have, holding
+				   back any whitespace that might turn out to be
+				   trailing. A run of whitespace too long to hold
+				   back is written as is */
+				e = ibuf + len;
+				if (!cont && (err = line_start(&st, &s, e)) != ERR_NONE)
+					return err;
+				t = opt->trim ? trim_end(s, e) : e;
+				if (t == ibuf)
+					t = e;
+				if ((err = put(&st, s, t - s)) != ERR_NONE)
+					return err;
+				len = e - t;
+				memmove(ibuf, t, len);
+				cont = true;
+			} else if (pos > 0) {
+				/* keep the partial line and read more after it */
+				len -= pos;
+				memmove(ibuf, s, len);
+				pos = 0;
+			}
+			n = fread(ibuf + len, 1, FMT_BUFSIZE - len, in);
+			if (n == 0) {
+				if (ferror(in))
+					return fail(&st, 0, "read failed");
+				eof = true;
+			}
+			len += n;
+			continue;
+		}
+		if (e == NULL) {
+			/* the last line has no newline */
+			if (pos == len && !cont)
+				break;
+			e = ibuf + len;
+		}
+		if (!cont && (err = line_start(&st, &s, e)) != ERR_NONE)
+			return err;
+		cont = false;
+		t = opt->trim ? trim_end(s, e) : e;
+		if ((err = put(&st, s, t - s)) != ERR_NONE
+				|| (err = put(&st, "\n", 1)) != ERR_NONE)
+			return err;
+		pos = e - ibuf + 1;
+		if (pos >= len && eof)
+			break;
+	}
+	return flush(&st);
+}
+
+/* record an error at the current line */
+static enum errcode fail(struct fmt_state *st, int column, const char *msg)
+{
+	st->res->column = column;
+	st->res->msg = msg;
+	return column > 0 ? ERR_FORMAT : ERR_IO;
+}
+
+/* check the indentation of the line starting at *s, write its new
+   indentation and advance *s past the old one. These are the rules
+   read_tree() applies: the first whitespace character to start a line is
+   the indent character, and for spaces the first indent is one level */
+static enum errcode line_start(struct fmt_state *st, const char **s,
+		const char *e)
+{
+	const char *p = *s;
+	int count, depth;
+
+	st->res->lines++;
+	if (st->delim == '\0' && p < e && (*p == ' ' || *p == '\t'))
+		st->delim = *p;
+	while (p < e && *p == st->delim && st->delim != '\0') {
+		p++;
+	}
+	count = p - *s;
+	depth = count;
+	if (count > 0 && st->delim == ' ') {
+		if (st->width == 0)
+			st->width = count;
+		if (count % st->width != 0)
+			return fail(st, count + 1, "indent is not a multiple "
+					"of the first indent");
+		depth = count / st->width;
+	}
+	if (depth > st->prev + 1)
+		return fail(st, count + 1, "invalid indentation");
+	st->prev = depth;
+	if (depth > st->res->depth)
+		st->res->depth = depth;
+
+	*s = p;
+	switch (st->opt->indent) {
+	case '\t':
+		return put_indent(st, '\t', depth);
+	case ' ':
+		return put_indent(st, ' ', (size_t)depth * st->opt->width);
+	default:
+		return put(st, p - count, count);
+	}
+}
+
+/* return the end of s..e without its trailing whitespace */
+static const char *trim_end(const char *s, const char *e)
+{
+	while (e > s && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r')) {
+		e--;
+	}
+	return e;
+}
+
+/* append n bytes to the output buffer */
+static enum errcode put(struct fmt_state *st, const char *s, size_t n)
+{
+	enum errcode err;
+	if (st->opt->check)
+		return ERR_NONE;
+	if (olen + n > FMT_BUFSIZE && (err = flush(st)) != ERR_NONE)
+		return err;
+	if (n > FMT_BUFSIZE) {
+		if (fwrite(s, 1, n, st->out) != n)
+			return fail(st, 0, "write failed");
+		return ERR_NONE;
+	}
+	memcpy(&obuf[olen], s, n);
+	olen += n;
+	return ERR_NONE;
+}
+
+/* append n copies of c to the output buffer */
+static enum errcode put_indent(struct fmt_state *st, char c, size_t n)
+{
+	enum errcode err;
+	if (st->opt->check)
+		return ERR_NONE;
+	while (n > 0) {
+		size_t run = n < FMT_BUFSIZE - olen ? n : FMT_BUFSIZE - olen;
+		memset(&obuf[olen], c, run);
+		olen += run;
+		n -= run;
+		if (olen == FMT_BUFSIZE && (err = flush(st)) != ERR_NONE)
+			return err;
+	}
+	return ERR_NONE;
+}
+
+/* write out the output buffer */
+static enum errcode flush(struct fmt_state *st)
+{
+	if (olen > 0 && fwrite(obuf, 1, olen, st->out) != olen)
+		return fail(st, 0, "write failed");
+	olen = 0;
+	return ERR_NONE;
+}
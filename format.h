@@ -0,0 +1,31 @@
+#ifndef TT_FORMAT_H
+#define TT_FORMAT_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "exception.h"
+
+/* How format_stream should rewrite its input */
+struct fmt_options {
+	char indent;     /* '\t' or ' ' to re-indent, '\0' to keep as is */
+	int width;       /* spaces per level when indent is ' ' */
+	bool trim;       /* strip trailing whitespace, including '\r' */
+	bool check;      /* only validate, write nothing */
+};
+
+/* What format_stream found */
+struct fmt_result {
+	long lines;      /* lines read, or line number of the error */
+	int column;      /* column of the error */
+	int depth;       /* deepest indentation seen */
+	const char *msg; /* description of the error, if any */
+};
+
+/* validate and optionally rewrite a tree file one buffer at a time, using
+   the same indentation rules as the loader. returns ERR_NONE, ERR_FORMAT
+   or ERR_IO and fills in res */
+enum errcode format_stream(FILE *in, FILE *out,
+		const struct fmt_options *opt, struct fmt_result *res);
+
+#endif /* TT_FORMAT_H */
@@ -0,0 +1,105 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree.h"
+#include "gen.h"
+
+/* State shared by one run of generate */
+struct gen_state {
+	const struct gen_options *opt;
+	FILE *f;
+	unsigned long rand;
+	long left;   /* entries still to write */
+	long bytes;  /* bytes written so far */
+};
+
+/* static prototypes */
+static unsigned long next_rand(struct gen_state *gs);
+static void gen_entry(struct gen_state *gs, int depth);
+
+/* fill in the default tree shape */
+void gen_defaults(struct gen_options *opt)
+{
+	opt->depth = 8;
+	opt->fanout = 6;
+	opt->textlen = 40;
+	opt->lines = 200000;
+	opt->seed = 1;
+}
+
+/* set the option named by flag from val */
+bool gen_flag(struct gen_options *opt, const char *flag, const char *val)
+{
+	long n = val != NULL ? atol(val) : 0;
+
+	if (n <= 0 || strlen(flag) != 2 || flag[0] != '-')
+		return false;
+	switch (flag[1]) {
+	case 'd': opt->depth = n; break;
+	case 'f': opt->fanout = n; break;
+	case 'l': opt->textlen = n; break;
+	case 'n': opt->lines = n; break;
+	case 's': opt->seed = n; break;
+	default: return false;
+	}
+	return true;
+}
+
+/* write a synthetic tree file to f, returning the number of bytes written */
+long generate(FILE *f, const struct gen_options *opt)
+{
+	struct gen_state gs;
+
+	gs.opt = opt;
+	gs.f = f;
+	gs.rand = opt->seed != 0 ? opt->seed : 1;
+	gs.left = opt->lines;
+	gs.bytes = 0;
+	while (gs.left > 0) {
+		gen_entry(&gs, 0);
+	}
+	return gs.bytes;
+}
+
+/* xorshift, so the output doesn't depend on the C library's rand() */
+static unsigned long next_rand(struct gen_state *gs)
+{
+	unsigned long x = gs->rand & 0xFFFFFFFFUL;
+	x ^= (x << 13) & 0xFFFFFFFFUL;
+	x ^= x >> 17;
+	x ^= (x << 5) & 0xFFFFFFFFUL;
+	gs->rand = x;
+	return x;
+}
+
+/* write one entry of random words and, recursively, its children */
+static void gen_entry(struct gen_state *gs, int depth)
+{
+	const struct gen_options *opt = gs->opt;
+	int len = opt->textlen < MAX_ENTRY_LEN ? opt->textlen : MAX_ENTRY_LEN-1;
+	long nchild;
+	int i;
+
+	if (gs->left <= 0)
+		return;
+	gs->left--;
+	for (i = 0; i < depth; i++) {
+		putc('\t', gs->f);
+	}
+	for (i = 0; i < len; i++) {
+		unsigned long r = next_rand(gs);
+		/* start with a letter and end words about every six */
+		putc(i > 0 && i < len - 1 && r % 6 == 0 ? ' ' : 'a' + (int)(r % 26),
+				gs->f);
+	}
+	putc('\n', gs->f);
+	gs->bytes += depth + len + 1;
+
+	if (depth + 1 >= opt->depth || opt->fanout <= 0)
+		return;
+	/* vary the fanout around its average so siblings differ in size */
+	nchild = 1 + next_rand(gs) % (2 * opt->fanout - 1);
+	while (nchild-- > 0 && gs->left > 0) {
+		gen_entry(gs, depth + 1);
+	}
+}
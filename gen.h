@@ -0,0 +1,26 @@
+#ifndef TT_GEN_H
+#define TT_GEN_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+/* Shape of a synthetic tree */
+struct gen_options {
+	int depth;           /* number of levels */
+	int fanout;          /* average children per entry above the last level */
+	int textlen;         /* characters of text per entry */
+	long lines;          /* total number of entries */
+	unsigned long seed;  /* the same seed always gives the same tree */
+};
+
+/* fill in the default tree shape */
+void gen_defaults(struct gen_options *opt);
+
+/* set the option named by flag (-d, -f, -l, -n or -s) from val, returning
+   false if flag isn't one of them or val isn't a positive number */
+bool gen_flag(struct gen_options *opt, const char *flag, const char *val);
+
+/* write a synthetic tree file to f, returning the number of bytes written */
+long generate(FILE *f, const struct gen_options *opt);
+
+#endif /* TT_GEN_H */
@@ -0,0 +1,63 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "tree.h"
+#include "batch.h"
+#include "autosave.h"
+#include "tt.h"
+
+/******************************************************************************
+	Entry point
+*/
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "-b") == 0)
+		return batch(argc - 2, argv + 2);
+
+	help_mode = SHOW_HELP_DEFAULT ? H_NORMAL : H_HIDE;
+	memset(filename, 0, MAX_ENTRY_LEN);
+
+	/* curses is started first so that loading can ask questions */
+	init_curses();
+	autosave_start();
+	if (argc > 1) {
+		FILE *f = fopen(argv[1], "r");
+		if (f != NULL) {
+			/* never clobber an existing file that failed to load */
+			fclose(f);
+			load(argv[1]);
+		} else {
+			f = fopen(argv[1], "w");
+			if (f) {
+				char temp[MAX_SAY_CHARS];
+				int len = strlen(argv[1]);
+				if (len > MAX_ENTRY_LEN-1)
+					len = MAX_ENTRY_LEN-1;
+				sprintf(temp, "Created '%s'", argv[1]);
+				fclose(f);
+				load(argv[1]);
+				squelch();
+				say(temp);
+				memcpy(filename, argv[1], len);
+				filename[len] = '\0';
+			} else {
+				say("Failed to create file.");
+			}
+		}
+	}
+	if (root == NULL) {
+		root = add_child(NULL, "Entries");
+		saved_hash = recover_hash = tree_hash(root);
+	}
+	if (selected_entry == NULL)
+		selected_entry = root;
+	offer_recovery();
+
+	menu();
+	autosave_stop();
+	paste_mode(false);
+	endwin();
+
+	return 0;
+}
@@ -5,7 +5,7 @@
 
 /* Structure to represent the state of a readline in progress */
 struct rlstate {
-	char buf[MAXLEN];
+	char buf[MAXLEN + 1];
 	int len;     /* total number of chars typed so far */
 	int cur;     /* horizontal cursor position */
 	int scr;     /* horizontal scroll position */
@@ -15,10 +15,25 @@ struct rlstate {
 		INSERT,
 		REPLACE
 	} mode;
-	char cut[MAXLEN];
-	int cutlen;
+	int last;     /* the previous key, to tell runs of cuts, pastes and tabs */
+	int yank;     /* where the last paste put its text, and how much */
+	int yanklen;
+	int kill;     /* how many cuts back the last paste was */
+	int hist;     /* how many lines back Up has gone, 0 for the typed one */
+	char typed[MAXLEN + 1];
+	rl_completer complete;
+	char **matches; /* the completions that repeated tabs go through */
+	long nmatches;
+	long match;
 };
 
+/* lines entered and text cut, shared by every readline. Each is a ring
+   whose newest entry is at (count - 1) % size */
+static char history[RL_HISTORY][MAXLEN + 1];
+static long nhistory;
+static char kills[RL_KILLS][MAXLEN + 1];
+static long nkills;
+
 /* static prototypes */
 static void left(struct rlstate *rl);
 static void right(struct rlstate *rl);
@@ -36,6 +51,14 @@ static void invalid(struct rlstate *rl);
 static void wordb(struct rlstate *rl);
 static void wordf(struct rlstate *rl);
 static void paste(struct rlstate *rl);
+static void cut(struct rlstate *rl, int from, int to);
+static bool is_cut(int c);
+static int put(struct rlstate *rl, const char *str, int n);
+static void show_cursor(struct rlstate *rl);
+static void recall(struct rlstate *rl, int dir);
+static void complete(struct rlstate *rl);
+static void replace_prefix(struct rlstate *rl, const char *str, int n);
+static void paste_text(struct rlstate *rl);
 
 /* allocate and init rlstate structure, make cur visible, enable keypad */
 struct rlstate *rl_start(WINDOW *w)
@@ -53,6 +76,22 @@ struct rlstate *rl_start(WINDOW *w)
 	return rl;
 }
 
+/* Move the readline to a different window, e.g. after a resize */
+void rl_setwin(struct rlstate *rl, WINDOW *w)
+{
+	int h, ww;
+	if (rl->win != w)
+		keypad(w, TRUE);
+	rl->win = w;
+	getmaxyx(rl->win, h, ww);
+	(void)(h);
+	/* scroll if the window narrowed */
+	if (rl->cur - rl->scr >= ww-1)
+		rl->scr = rl->cur - (ww-1);
+	if (rl->scr < 0)
+		rl->scr = 0;
+}
+
 /* Set the line's contents (used for editing existing lines) */
 void rl_set(struct rlstate *rl, const char *str)
 {
@@ -65,6 +104,13 @@ void rl_set(struct rlstate *rl, const char *str)
 	rl->scr = 0;
 }
 
+/* complete with fn when Tab is pressed, or not at all if fn is NULL */
+void rl_setcomplete(struct rlstate *rl, rl_completer fn)
+{
+	rl->complete = fn;
+	rl->nmatches = 0;
+}
+
 /* draw the current state of the readline */
 void rl_draw(struct rlstate *rl)
 {
@@ -94,12 +140,20 @@ int rl_read(struct rlstate *rl)
 	switch (c) {
 	/* Silently do nothing so that the calling program can respond */
 	case 0x1F: /* C-? */
-	case '\t': break;
+	case KEY_RESIZE: break;
+	/* Text pasted into the terminal */
+	case KEY_PASTE: paste_text(rl); break;
+	case KEY_PASTE_END: break;
+	/* Tab (Complete, again to go through the matches) */
+	case '\t': complete(rl); break;
+	/* C-p / C-n (Recall older and newer lines) */
+	case 0x10:
+	case KEY_UP: recall(rl, 1); break;
+	case 0x0E:
+	case KEY_DOWN: recall(rl, -1); break;
 	/* Intercept these keys so they do nothing */
 	case KEY_NPAGE:
-	case KEY_PPAGE:
-	case KEY_UP:
-	case KEY_DOWN: invalid(rl); break;
+	case KEY_PPAGE: invalid(rl); break;
 	/* Newline / Carriage return (Complete entry) */
 	case '\n':
 	case '\r': break;
@@ -113,7 +167,7 @@ int rl_read(struct rlstate *rl)
 	case 0x17: wordb(rl); break;
 	/* C-x (Cut next word) */
 	case 0x18: wordf(rl); break;
-	/* C-v / C-y (Paste) */
+	/* C-v / C-y (Paste, again for the cut before) */
 	case 0x16:
 	case 0x19: paste(rl); break;
 	/* C-b (Left) */
@@ -138,15 +192,20 @@ int rl_read(struct rlstate *rl)
 	/* insert ASCII char */
 	default: type(rl, c); break;
 	}
+	rl->last = c;
 	return c;
 }
 
 /* deallocate the readline and return the entered string */
 char *rl_finish(struct rlstate *rl)
 {
-	char *retstr;
+	char *retstr, *prev;
 
 	rl->buf[rl->len] = '\0';
+	/* one key answers aren't worth recalling */
+	prev = nhistory > 0 ? history[(nhistory - 1) % RL_HISTORY] : "";
+	if (rl->len > 1 && strcmp(rl->buf, prev) != 0)
+		strcpy(history[nhistory++ % RL_HISTORY], rl->buf);
 	retstr = malloc(rl->len+1);
 	memcpy(retstr, rl->buf, rl->len+1);
 	retstr[rl->len] = '\0';
@@ -188,7 +247,7 @@ void del(struct rlstate *rl)
 			&rl->buf[rl->cur+1],
 			rl->len - rl->cur);
 	rl->len--;
-	memset(&rl->buf[rl->len], 0, MAXLEN - rl->len);
+	memset(&rl->buf[rl->len], 0, MAXLEN + 1 - rl->len);
 }
 
 /* moves the cursor back and deletes that character */
@@ -237,79 +296,85 @@ void type(struct rlstate *rl, int c)
 	}
 }
 
-/* cuts from the cursor to the previous whitespace */
+/* cuts from the cursor to the start of the word before it */
 void wordb(struct rlstate *rl)
 {
-	int dst = rl->cur - 1;
+	int dst = rl->cur;
 	/* first skip any whitespace we're on */
-	while (dst > 0 && rl->buf[dst] == ' ') {
+	while (dst > 0 && rl->buf[dst-1] == ' ') {
 		dst--;
 	}
 	/* now cut until the beginning of the word we found */
 	while (dst > 0 && rl->buf[dst-1] != ' ') {
 		dst--;
 	}
-	if (dst != rl->cur - 1)
-		rl->cutlen = 0;
-	
-	while (rl->cur > dst && rl->cur > 0) {
-		rl->cut[rl->cutlen++] = rl->buf[rl->cur - 1];
-		bksp(rl);
-	}
-	rl->cut[rl->cutlen] = '\0';
+	cut(rl, dst, rl->cur);
 }
 
-/* cuts from the cursor to the next whitespace */
+/* cuts from the cursor to the end of the word after it */
 void wordf(struct rlstate *rl)
 {
-	int dst = rl->cur + 1;
+	int dst = rl->cur;
 	/* first skip any whitespace we're on */
 	while (dst < rl->len && rl->buf[dst] == ' ') {
 		dst++;
 	}
-	/* now cut until the beginning of the word we found */
-	while (dst < rl->len && rl->buf[dst+1] != ' ') {
+	/* now cut until the end of the word we found */
+	while (dst < rl->len && rl->buf[dst] != ' ') {
 		dst++;
 	}
-
-	if (dst != rl->cur + 1)
-		rl->cutlen = 0;
-
-	while (rl->cur <= dst) {
-		rl->cut[rl->cutlen++] = rl->buf[rl->cur];
-		del(rl);
-		dst--;
-	}
-	rl->cut[rl->cutlen] = '\0';
+	cut(rl, rl->cur, dst);
 }
 
 /* cut (back) from the cursor to the start of the line */
 void cutb(struct rlstate *rl)
 {
-	if (rl->cur > 0) {
-		memcpy(rl->cut, rl->buf, rl->cur+1);
-		rl->cutlen = rl->cur;
-		rl->cut[rl->cutlen] = '\0';
-	}
-
-	memmove(rl->buf, &rl->buf[rl->cur], rl->len - rl->cur);
-	rl->len -= rl->cur;
-	memset(&rl->buf[rl->len], 0, MAXLEN - rl->len);
-	rl->cur = 0;
-	left(rl); /* scroll if needed */
+	cut(rl, 0, rl->cur);
 }
 
 /* cut (forward) from the cursor to the end of the line */
 void cutf(struct rlstate *rl)
 {
-	if (rl->cur < rl->len) {
-		memcpy(rl->cut, &rl->buf[rl->cur], rl->len-rl->cur+1);
-		rl->cutlen = rl->len - rl->cur;
-		rl->cut[rl->cutlen] = '\0';
+	cut(rl, rl->cur, rl->len);
+}
+
+/* remove the text from 'from' to 'to' onto the kill ring. A run of cuts
+   adds to the same entry, in front if it cut back from the cursor */
+static void cut(struct rlstate *rl, int from, int to)
+{
+	char *k;
+	int len = to - from, klen;
+
+	if (len <= 0)
+		return;
+	if (is_cut(rl->last) && nkills > 0) {
+		k = kills[(nkills - 1) % RL_KILLS];
+		klen = strlen(k);
+		if (klen + len > MAXLEN)
+			klen = MAXLEN - len;
+		if (to == rl->cur) {
+			memmove(&k[len], k, klen);
+			memcpy(k, &rl->buf[from], len);
+		} else {
+			memcpy(&k[klen], &rl->buf[from], len);
+		}
+		k[klen + len] = '\0';
+	} else {
+		k = kills[nkills++ % RL_KILLS];
+		memcpy(k, &rl->buf[from], len);
+		k[len] = '\0';
 	}
-	rl->len = rl->cur;
-	memset(&rl->buf[rl->cur], 0, MAXLEN - rl->cur);
-	right(rl); /* scroll if needed */
+	memmove(&rl->buf[from], &rl->buf[to], rl->len - to);
+	rl->len -= len;
+	memset(&rl->buf[rl->len], 0, MAXLEN + 1 - rl->len);
+	rl->cur = from;
+	show_cursor(rl);
+}
+
+/* whether key c cuts text */
+static bool is_cut(int c)
+{
+	return c == 0x0B || c == 0x15 || c == 0x17 || c == 0x18;
 }
 
 /* move the cursor all the way left */
@@ -339,15 +404,131 @@ void invalid(struct rlstate *rl)
 	rl->msg = "> Invalid input.";
 }
 
+/* paste the newest cut. Pasting again straight away swaps what the last
+   paste put in for the cut before it */
 void paste(struct rlstate *rl)
 {
-	int i = 0;
-	if (rl->cutlen <= 0) {
+	long n = nkills < RL_KILLS ? nkills : RL_KILLS;
+
+	if (n == 0) {
 		rl->msg = "> Clipboard empty.";
 		return;
 	}
+	if (rl->last == 0x16 || rl->last == 0x19) {
+		memmove(&rl->buf[rl->yank], &rl->buf[rl->yank + rl->yanklen],
+				rl->len - rl->yank - rl->yanklen);
+		rl->len -= rl->yanklen;
+		memset(&rl->buf[rl->len], 0, MAXLEN + 1 - rl->len);
+		rl->cur = rl->yank;
+		rl->kill = rl->kill % n + 1;
+	} else {
+		rl->yank = rl->cur;
+		rl->kill = 1;
+	}
+	rl->yanklen = put(rl, kills[(nkills - rl->kill) % RL_KILLS],
+			strlen(kills[(nkills - rl->kill) % RL_KILLS]));
+}
+
+/* insert up to n chars of str at the cursor, as many as fit, and move past
+   them. Returns how many were inserted */
+static int put(struct rlstate *rl, const char *str, int n)
+{
+	if (n > MAXLEN - rl->len)
+		n = MAXLEN - rl->len;
+	memmove(&rl->buf[rl->cur + n], &rl->buf[rl->cur], rl->len - rl->cur);
+	memcpy(&rl->buf[rl->cur], str, n);
+	rl->len += n;
+	rl->buf[rl->len] = '\0';
+	rl->cur += n;
+	show_cursor(rl);
+	return n;
+}
+
+/* scroll so that the cursor shows */
+static void show_cursor(struct rlstate *rl)
+{
+	int w, h;
+	getmaxyx(rl->win, h, w);
+	(void)(h);
+	if (rl->cur < rl->scr)
+		rl->scr = rl->cur;
+	if (rl->cur - rl->scr >= w-1)
+		rl->scr = rl->cur - (w-1);
+}
+
+/* replace the line with one older (dir 1) or newer (-1) in the history,
+   keeping what was being typed to come back to */
+static void recall(struct rlstate *rl, int dir)
+{
+	long n = nhistory < RL_HISTORY ? nhistory : RL_HISTORY;
+	int hist = rl->hist + dir;
+
+	if (hist < 0 || hist > n)
+		return;
+	if (rl->hist == 0)
+		strcpy(rl->typed, rl->buf);
+	rl->hist = hist;
+	rl_set(rl, hist == 0 ? rl->typed
+			: history[(nhistory - hist) % RL_HISTORY]);
+	end(rl);
+}
+
+/* complete the text before the cursor as far as every match agrees, or
+   if it already does, put in each match in turn */
+static void complete(struct rlstate *rl)
+{
+	char **m;
+	long n;
+	int same;
+
+	if (rl->complete == NULL)
+		return;
+	if (rl->last == '\t' && rl->nmatches > 1) {
+		rl->match = (rl->match + 1) % rl->nmatches;
+		m = &rl->matches[rl->match];
+		replace_prefix(rl, *m, strlen(*m));
+		return;
+	}
+	rl->nmatches = 0;
+	if ((n = rl->complete(rl->buf, rl->cur, &m)) == 0) {
+		rl->msg = "> No matches.";
+		return;
+	}
+	/* the matches are sorted, so the first and last differ soonest */
+	for (same = 0; m[0][same] != '\0' && m[0][same] == m[n-1][same]; same++)
+		;
+	if (same > rl->cur || n == 1) {
+		replace_prefix(rl, m[0], same);
+	} else {
+		rl->matches = m;
+		rl->nmatches = n;
+		rl->match = 0;
+		replace_prefix(rl, m[0], strlen(m[0]));
+	}
+}
 
-	for (i = rl->cutlen-1; i >= 0; i--) {
-		insert(rl, rl->cut[i]);
+/* type in pasted text up to the end of the paste, line breaks and tabs
+   as spaces, dropping what can't be typed */
+static void paste_text(struct rlstate *rl)
+{
+	int c;
+	/* stop waiting if the end of the paste never comes */
+	wtimeout(rl->win, PASTE_TIMEOUT);
+	while ((c = wgetch(rl->win)) != KEY_PASTE_END && c != ERR) {
+		if (c == '\n' || c == '\r' || c == '\t')
+			c = ' ';
+		if (c >= ' ' && c <= '~' && rl->len < MAXLEN)
+			type(rl, c);
 	}
+	wtimeout(rl->win, -1);
+}
+
+/* replace the text before the cursor with n chars of str */
+static void replace_prefix(struct rlstate *rl, const char *str, int n)
+{
+	memmove(rl->buf, &rl->buf[rl->cur], rl->len - rl->cur);
+	rl->len -= rl->cur;
+	memset(&rl->buf[rl->len], 0, MAXLEN + 1 - rl->len);
+	rl->cur = 0;
+	put(rl, str, n);
 }
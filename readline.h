@@ -6,22 +6,49 @@
 /* maximum input size */
 #define MAXLEN 256
 
+/* most lines kept for Up and Down to recall, shared by every readline */
+#define RL_HISTORY 64
+
+/* most cuts kept for C-y to paste, shared by every readline */
+#define RL_KILLS 16
+
+/* keys for the sequences a terminal in bracketed paste mode sends before
+   and after pasted text, for the caller to set up with define_key */
+#define KEY_PASTE (KEY_MAX + 1)
+#define KEY_PASTE_END (KEY_MAX + 2)
+
+/* time in ms to wait for more of a paste before taking it as ended */
+#define PASTE_TIMEOUT 1000
+
 /* opaque struct representing a line being read */
 struct rlstate;
 
+/* a source of Tab completions. Given the len chars before the cursor,
+   point *matches at the sorted candidates that start with them and
+   return how many there are. They must stay valid until the next call */
+typedef long (*rl_completer)(const char *prefix, int len, char ***matches);
+
 /* allocate and init rlstate structure, make cur visible, enable keypad */
 struct rlstate *rl_start(WINDOW *w);
 
+/* move the readline to a different window, e.g. after a resize */
+void rl_setwin(struct rlstate *rl, WINDOW *w);
+
 /* set the line's contents to the given string */
 void rl_set(struct rlstate *rl, const char *str);
 
+/* complete with fn when Tab is pressed, or not at all if fn is NULL */
+void rl_setcomplete(struct rlstate *rl, rl_completer fn);
+
 /* draw the current state of the readline */
 void rl_draw(struct rlstate *rl);
 
-/* read in one character and perform an appropriate action */
+/* read in one character and perform an appropriate action. A paste is
+   read whole and typed in on one line */
 int rl_read(struct rlstate *rl);
 
-/* deallocate the readline and return the entered string */
+/* deallocate the readline and return the entered string, which is
+   added to the history */
 char *rl_finish(struct rlstate *rl);
 
 #endif /* TT_READLINE_H */
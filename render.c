@@ -0,0 +1,249 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "render.h"
+
+/* a framebuffer cell value that never matches a drawn cell, so the cells
+   of a new or moved surface all count as changed on their next refresh */
+#define UNSHOWN ((chtype)-1)
+
+/* escape sequences used to estimate the bytes sent to a terminal */
+#define MOVE_BYTES 6     /* ESC [ row ; col H, with short numbers */
+#define ATTR_BYTES 4     /* ESC [ n m */
+
+struct render_counts render_counts;
+bool headless;
+
+/* size of the headless screen */
+static int screen_h, screen_w;
+
+/* static prototypes */
+static void fb_newline(struct surface *s);
+static void fb_put(struct surface *s, chtype c);
+
+/* draw into framebuffers with a screen of h rows by w columns */
+void r_headless(int h, int w)
+{
+	headless = true;
+	screen_h = h;
+	screen_w = w;
+}
+
+/* store the size of the screen in h and w */
+void r_screen(int *h, int *w)
+{
+	if (headless) {
+		*h = screen_h;
+		*w = screen_w;
+	} else {
+		getmaxyx(stdscr, *h, *w);
+	}
+}
+
+/* set the surface's position and size, creating it if needed */
+void r_place(struct surface *s, int h, int w, int y, int x)
+{
+	int i;
+	if (!headless) {
+		s->win = set_window(s->win, h, w, y, x);
+	} else if (!s->open || h != s->h || w != s->w
+			|| y != s->top || x != s->left) {
+		if (h * w > s->alloc) {
+			s->alloc = h * w;
+			s->cell = realloc(s->cell, sizeof(*s->cell) * s->alloc);
+			s->shown = realloc(s->shown, sizeof(*s->shown) * s->alloc);
+		}
+		for (i = 0; i < h * w; i++) {
+			s->cell[i] = ' ';
+			s->shown[i] = UNSHOWN;
+		}
+		s->y = s->x = 0;
+		s->attr = 0;
+	}
+	s->open = true;
+	s->h = h;
+	s->w = w;
+	s->top = y;
+	s->left = x;
+}
+
+/* release the surface; drawing into it is ignored until it is placed */
+void r_remove(struct surface *s)
+{
+	if (s->win != NULL)
+		delwin(s->win);
+	free(s->cell);
+	free(s->shown);
+	memset(s, 0, sizeof(*s));
+}
+
+void r_move(struct surface *s, int y, int x)
+{
+	if (!s->open)
+		return;
+	if (s->win != NULL) {
+		wmove(s->win, y, x);
+	} else if (y >= 0 && y < s->h && x >= 0 && x < s->w) {
+		s->y = y;
+		s->x = x;
+	}
+}
+
+void r_addch(struct surface *s, int c)
+{
+	if (!s->open)
+		return;
+	render_counts.cells++;
+	if (s->win != NULL)
+		waddch(s->win, c);
+	else if (c == '\n')
+		fb_newline(s);
+	else
+		fb_put(s, c);
+}
+
+void r_addstr(struct surface *s, const char *str)
+{
+	r_addnstr(s, str, -1);
+}
+
+/* a negative n writes the whole string, as in curses */
+void r_addnstr(struct surface *s, const char *str, int n)
+{
+	int i;
+	if (!s->open)
+		return;
+	if (s->win != NULL) {
+		int len = strlen(str);
+		render_counts.cells += n >= 0 && n < len ? n : len;
+		waddnstr(s->win, str, n);
+		return;
+	}
+	for (i = 0; str[i] != '\0' && (n < 0 || i < n); i++) {
+		render_counts.cells++;
+		if (str[i] == '\n')
+			fb_newline(s);
+		else
+			fb_put(s, (unsigned char)str[i]);
+	}
+}
+
+void r_attron(struct surface *s, int attr)
+{
+	if (s->win != NULL)
+		wattron(s->win, attr);
+	s->attr |= attr;
+}
+
+void r_attroff(struct surface *s, int attr)
+{
+	if (s->win != NULL)
+		wattroff(s->win, attr);
+	s->attr &= ~attr;
+}
+
+void r_clrtoeol(struct surface *s)
+{
+	int x;
+	if (!s->open)
+		return;
+	if (s->win != NULL) {
+		wclrtoeol(s->win);
+		return;
+	}
+	if (s->y >= s->h)
+		return;
+	for (x = s->x; x < s->w; x++) {
+		s->cell[s->y * s->w + x] = ' ';
+	}
+}
+
+/* queue the surface for output. For a framebuffer, count the cells that
+   changed since the last refresh and estimate what sending them costs */
+void r_refresh(struct surface *s)
+{
+	int y, x, i;
+	int ly = -1, lx = -1;
+	chtype lattr = 0;
+
+	if (!s->open)
+		return;
+	if (s->win != NULL) {
+		wnoutrefresh(s->win);
+		return;
+	}
+	for (y = 0; y < s->h; y++) {
+		for (x = 0; x < s->w; x++) {
+			i = y * s->w + x;
+			if (s->cell[i] == s->shown[i])
+				continue;
+			if (y != ly || x != lx)
+				render_counts.bytes += MOVE_BYTES;
+			if ((s->cell[i] & A_ATTRIBUTES) != lattr) {
+				lattr = s->cell[i] & A_ATTRIBUTES;
+				render_counts.bytes += ATTR_BYTES;
+			}
+			render_counts.bytes++;
+			render_counts.changed++;
+			s->shown[i] = s->cell[i];
+			ly = y;
+			lx = x + 1;
+		}
+	}
+}
+
+/* send queued output to the terminal */
+void r_update()
+{
+	if (!headless)
+		doupdate();
+}
+
+/* write one character at the framebuffer cursor and advance it */
+static void fb_put(struct surface *s, chtype c)
+{
+	if (s->y >= s->h || s->w == 0)
+		return;
+	s->cell[s->y * s->w + s->x] = c | s->attr;
+	if (++s->x < s->w)
+		return;
+	if (s->y < s->h - 1) {
+		s->x = 0;
+		s->y++;
+	} else {
+		s->x = s->w - 1;
+	}
+}
+
+/* clear the rest of the line and move to the start of the next, staying
+   on the last line as a curses window without scrolling does */
+static void fb_newline(struct surface *s)
+{
+	r_clrtoeol(s);
+	s->x = 0;
+	if (s->y < s->h - 1)
+		s->y++;
+}
+
+/* set the window's position and size, reallocating if necessary */
+WINDOW *set_window(WINDOW *win, int h, int w, int y, int x)
+{
+	int wy, wx, ww, wh;
+	if (win != NULL) {
+		getbegyx(win, wy, wx);
+		getmaxyx(win, wh, ww);
+		if (ww == w && wh == h && wx == x && wy == y)
+			return win;
+		/* curses refuses to move a window partly offscreen, so if the
+		   move fails try it again after resizing */
+		if (mvwin(win, y, x) == OK) {
+			if (wresize(win, h, w) == OK)
+				return win;
+		} else if (wresize(win, h, w) == OK && mvwin(win, y, x) == OK) {
+			return win;
+		}
+		delwin(win);
+		win = NULL;
+	}
+	return newwin(h, w, y, x);
+}
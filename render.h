@@ -0,0 +1,64 @@
+#ifndef TT_RENDER_H
+#define TT_RENDER_H
+
+#include <ncurses.h>
+#include <stdbool.h>
+
+/* A rectangle of the screen that the UI draws into. It is backed by a
+   curses window, or in headless mode by a framebuffer in memory so that
+   rendering can be replayed and timed without a terminal. */
+struct surface {
+	WINDOW *win;     /* curses backend */
+	chtype *cell;    /* framebuffer backend: the frame being drawn */
+	chtype *shown;   /* framebuffer backend: the last refreshed frame */
+	int alloc;       /* cells allocated in cell and shown */
+	bool open;       /* false until placed, and after being removed */
+	int h, w;        /* size */
+	int top, left;   /* position on the screen */
+	int y, x;        /* framebuffer backend: cursor */
+	chtype attr;     /* framebuffer backend: current attributes */
+};
+
+/* Totals across every surface since the last reset */
+struct render_counts {
+	long cells;      /* cells written by the UI */
+	long changed;    /* cells that differed from the last refresh */
+	long bytes;      /* estimated bytes a terminal would have been sent */
+};
+
+extern struct render_counts render_counts;
+
+/* true once r_headless has switched to the framebuffer backend */
+extern bool headless;
+
+/* draw into framebuffers with a screen of h rows by w columns */
+void r_headless(int h, int w);
+
+/* store the size of the screen in h and w */
+void r_screen(int *h, int *w);
+
+/* set the surface's position and size, creating it if needed */
+void r_place(struct surface *s, int h, int w, int y, int x);
+
+/* release the surface; drawing into it is ignored until it is placed */
+void r_remove(struct surface *s);
+
+/* drawing, as the curses functions of the same names */
+void r_move(struct surface *s, int y, int x);
+void r_addch(struct surface *s, int c);
+void r_addstr(struct surface *s, const char *str);
+void r_addnstr(struct surface *s, const char *str, int n);
+void r_attron(struct surface *s, int attr);
+void r_attroff(struct surface *s, int attr);
+void r_clrtoeol(struct surface *s);
+
+/* queue the surface for output, as wnoutrefresh */
+void r_refresh(struct surface *s);
+
+/* send queued output to the terminal, as doupdate */
+void r_update();
+
+/* set the window's position and size, reallocating if necessary */
+WINDOW *set_window(WINDOW *win, int h, int w, int y, int x);
+
+#endif /* TT_RENDER_H */
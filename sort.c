@@ -0,0 +1,229 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "sort.h"
+
+/* Subtrees shared out between the threads of a parallel sort */
+struct job {
+	enum sort_order order;
+	struct tree **task;   /* the subtrees, in preorder */
+	int ntask;
+	int next;             /* next task to hand out */
+	int level;            /* depth of the tasks below the sorted node */
+	pthread_mutex_t lock;
+};
+
+/* static prototypes */
+static int by_alpha(const void *a, const void *b);
+static int by_natural(const void *a, const void *b);
+static int by_size(const void *a, const void *b);
+static int collect(struct tree *t, int depth, int level, struct tree **task,
+		int n);
+static void sort_parallel(struct tree *t, enum sort_order order);
+static void sort_serial(struct tree *t, enum sort_order order);
+static void sort_children(struct tree *t, enum sort_order order);
+static void sort_upper(struct tree *t, int depth, struct job *job);
+static void *worker(void *arg);
+
+/* sort t's children, and if recursive the children of every entry below
+   t. Returns the number of entries below t */
+long sort_tree(struct tree *t, enum sort_order order, bool recursive)
+{
+	if (!recursive)
+		sort_children(t, order);
+	else if (t->ndesc >= SORT_PARALLEL_MIN)
+		sort_parallel(t, order);
+	else
+		sort_serial(t, order);
+	hash_dirty(t);
+	reshaped(t, 0);
+	return t->ndesc;
+}
+
+/* strcmp that orders runs of digits by their value, so "a9" < "a10" */
+int natural_cmp(const char *a, const char *b)
+{
+	const char *ea, *eb;
+	int d;
+
+	while (*a != '\0' && *b != '\0') {
+		if (!isdigit((unsigned char)*a) || !isdigit((unsigned char)*b)) {
+			if (*a != *b)
+				return (unsigned char)*a - (unsigned char)*b;
+			a++;
+			b++;
+			continue;
+		}
+		/* the longer number is bigger once leading zeros are gone */
+		while (*a == '0')
+			a++;
+		while (*b == '0')
+			b++;
+		for (ea = a; isdigit((unsigned char)*ea); ea++)
+			;
+		for (eb = b; isdigit((unsigned char)*eb); eb++)
+			;
+		if (ea - a != eb - b)
+			return ea - a < eb - b ? -1 : 1;
+		if ((d = strncmp(a, b, ea - a)) != 0)
+			return d;
+		a = ea;
+		b = eb;
+	}
+	return (unsigned char)*a - (unsigned char)*b;
+}
+
+/* sort t's children. Sizes come from the counts cached in each node.
+   Every entry visited loses its hash, so the ancestors of any reordered
+   entry have lost theirs as hash_dirty expects */
+static void sort_children(struct tree *t, enum sort_order order)
+{
+	int (*cmp)(const void*, const void*);
+	t->hashed = false;
+	if (t->nchild < 2)
+		return;
+	switch (order) {
+	case SORT_ALPHA:
+		cmp = by_alpha;
+		break;
+	case SORT_NATURAL:
+		cmp = by_natural;
+		break;
+	default:
+		cmp = by_size;
+		break;
+	}
+	qsort(t->child, t->nchild, sizeof(*t->child), cmp);
+}
+
+/* sort every entry below t on this thread */
+static void sort_serial(struct tree *t, enum sort_order order)
+{
+	int i;
+	for (i = 0; i < t->nchild; i++) {
+		sort_serial(t->child[i], order);
+	}
+	sort_children(t, order);
+}
+
+/* Sort a large subtree by handing the subtrees at the shallowest level
+   with a few per thread to a pool of workers, then sorting the levels
+   above them once they're done */
+static void sort_parallel(struct tree *t, enum sort_order order)
+{
+	pthread_t thread[SORT_MAX_THREADS];
+	struct job job;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int nthreads = cpus < 1 ? 1 : cpus > SORT_MAX_THREADS
+		? SORT_MAX_THREADS : (int)cpus;
+	int started, i, n;
+
+	if (nthreads < 2) {
+		sort_serial(t, order);
+		return;
+	}
+	memset(&job, 0, sizeof(job));
+	job.order = order;
+	for (job.level = 1; ; job.level++) {
+		n = collect(t, 0, job.level, NULL, 0);
+		if (n == 0) {
+			/* the tree ran out before it got wide enough */
+			sort_serial(t, order);
+			return;
+		}
+		if (n >= nthreads * 4)
+			break;
+	}
+	job.ntask = n;
+	job.task = malloc(sizeof(*job.task) * n);
+	collect(t, 0, job.level, job.task, 0);
+	pthread_mutex_init(&job.lock, NULL);
+
+	/* this thread works too, so it still finishes if none start */
+	for (started = 0; started < nthreads - 1; started++) {
+		if (pthread_create(&thread[started], NULL, worker, &job) != 0)
+			break;
+	}
+	worker(&job);
+	for (i = 0; i < started; i++) {
+		pthread_join(thread[i], NULL);
+	}
+	sort_upper(t, 0, &job);
+
+	pthread_mutex_destroy(&job.lock);
+	free(job.task);
+}
+
+/* sort the subtrees of a job until none are left */
+static void *worker(void *arg)
+{
+	struct job *job = arg;
+	int i;
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		i = job->next++;
+		pthread_mutex_unlock(&job->lock);
+		if (i >= job->ntask)
+			break;
+		sort_serial(job->task[i], job->order);
+	}
+	return NULL;
+}
+
+/* store the entries level below t in task from index n, returning the
+   new index. With a NULL task they're only counted */
+static int collect(struct tree *t, int depth, int level, struct tree **task,
+		int n)
+{
+	int i;
+	if (depth == level) {
+		if (task != NULL)
+			task[n] = t;
+		return n + 1;
+	}
+	for (i = 0; i < t->nchild; i++) {
+		n = collect(t->child[i], depth + 1, level, task, n);
+	}
+	return n;
+}
+
+/* sort the entries above a job's level once the workers have sorted the
+   subtrees at that level */
+static void sort_upper(struct tree *t, int depth, struct job *job)
+{
+	int i;
+	if (depth == job->level)
+		return;
+	for (i = 0; i < t->nchild; i++) {
+		sort_upper(t->child[i], depth + 1, job);
+	}
+	sort_children(t, job->order);
+}
+
+/* qsort comparisons of node pointers */
+static int by_alpha(const void *a, const void *b)
+{
+	const struct tree *ta = *(struct tree * const *)a;
+	const struct tree *tb = *(struct tree * const *)b;
+	return strcmp(ta->text, tb->text);
+}
+
+static int by_natural(const void *a, const void *b)
+{
+	const struct tree *ta = *(struct tree * const *)a;
+	const struct tree *tb = *(struct tree * const *)b;
+	int d = natural_cmp(ta->text, tb->text);
+	return d != 0 ? d : strcmp(ta->text, tb->text);
+}
+
+static int by_size(const void *a, const void *b)
+{
+	const struct tree *ta = *(struct tree * const *)a;
+	const struct tree *tb = *(struct tree * const *)b;
+	if (ta->ndesc != tb->ndesc)
+		return ta->ndesc > tb->ndesc ? -1 : 1;
+	return strcmp(ta->text, tb->text);
+}
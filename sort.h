@@ -0,0 +1,28 @@
+#ifndef TT_SORT_H
+#define TT_SORT_H
+
+#include <stdbool.h>
+
+#include "tree.h"
+
+/* recursive sorts of subtrees with at least this many entries are split
+   across worker threads */
+#define SORT_PARALLEL_MIN 50000
+
+/* most worker threads used by one sort */
+#define SORT_MAX_THREADS 8
+
+enum sort_order {
+	SORT_ALPHA,    /* by text */
+	SORT_NATURAL,  /* by text, comparing runs of digits as numbers */
+	SORT_SIZE      /* most descendants first, then by text */
+};
+
+/* sort t's children, and if recursive the children of every entry below
+   t. Returns the number of entries below t */
+long sort_tree(struct tree *t, enum sort_order order, bool recursive);
+
+/* strcmp that orders runs of digits by their value, so "a9" < "a10" */
+int natural_cmp(const char *a, const char *b);
+
+#endif /* TT_SORT_H */
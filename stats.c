@@ -0,0 +1,38 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "stats.h"
+
+struct stats stats;
+
+/* monotonic time in seconds */
+double stats_clock()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* format the overlay line into buf */
+void stats_line(char *buf, int size)
+{
+	snprintf(buf, size, "load %.1fms  save %.1fms  draw %.2fms  "
+			"key %.2fms  |  %ld nodes  %.1fK text  %.1fK heap  "
+			"%ld visited",
+			stats.load * 1e3, stats.save * 1e3, stats.redraw * 1e3,
+			stats.latency * 1e3, stats.nodes, stats.text / 1024.0,
+			stats.heap / 1024.0, stats.visited);
+}
+
+/* format a count to at most 5 characters, e.g. 950, 12k or 3.4M */
+void count_label(long n, char *buf, int size)
+{
+	if (n < 1000)
+		snprintf(buf, size, "%ld", n);
+	else if (n < 10000)
+		snprintf(buf, size, "%.1fk", n / 1e3);
+	else if (n < 1000000)
+		snprintf(buf, size, "%ldk", n / 1000);
+	else
+		snprintf(buf, size, "%.1fM", n / 1e6);
+}
@@ -0,0 +1,29 @@
+#ifndef TT_STATS_H
+#define TT_STATS_H
+
+/* Counters shown by the stats overlay. They are plain increments and
+   clock reads on paths that already do far more work, so they are always
+   compiled in. */
+struct stats {
+	double load;     /* seconds taken by the last load */
+	double save;     /* seconds taken by the last save */
+	double redraw;   /* seconds taken by the last redraw */
+	double latency;  /* seconds from reading a key to painting its result */
+	long visited;    /* nodes visited by the last print_tree */
+	long nodes;      /* nodes currently allocated */
+	long text;       /* bytes of entry text, including terminators */
+	long heap;       /* bytes allocated for nodes, text and child arrays */
+};
+
+extern struct stats stats;
+
+/* monotonic time in seconds */
+double stats_clock();
+
+/* format the overlay line into buf */
+void stats_line(char *buf, int size);
+
+/* format a count to at most 5 characters, e.g. 950, 12k or 3.4M */
+void count_label(long n, char *buf, int size);
+
+#endif /* TT_STATS_H */
@@ -0,0 +1,466 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "tags.h"
+
+/* A tag or attribute in the index. Its entries' preorder positions are
+   post[first] to post[first + count - 1], in order */
+struct term {
+	size_t at;      /* offset of the text in the block */
+	long first;
+	long count;
+	long last;      /* last position added, while building */
+};
+
+/* A word of a query and the part of its entries still to look through */
+struct word {
+	long lo, hi;
+};
+
+/* static prototypes */
+static void index_tree(struct tree *t);
+static void list_names();
+static void number(struct tree *t, long *pos);
+static void each_term(const char *s, long pos,
+		void (*use)(const char *s, int len, long pos));
+static void add_term(const char *s, int len, long pos);
+static void put_post(const char *s, int len, long pos);
+static void drop_post(const char *s, int len, long pos);
+static long intern(const char *s, int len);
+static long lookup(const char *s, int len);
+static void grow_table();
+static int term_end(const char *s);
+static bool is_word(int c);
+static long lower_bound(long lo, long hi, long pos);
+
+/* the tree indexed, and its hash and tree_links when it was. Folds
+   don't move anything, so they leave the index alone */
+static struct tree *idx_root;
+static unsigned long idx_hash;
+static unsigned long idx_links;
+static bool idx_valid;
+
+/* the entries of the tree by preorder position */
+static struct tree **order;
+static long norder;
+
+/* the terms, their text one after another in one block, and a hash
+   table of their numbers, -1 where empty */
+static struct term *terms;
+static long nterms;
+static long terms_alloc;
+static char *block;
+static size_t block_used;
+static size_t block_size;
+static long *table;
+static long table_size;
+
+/* the terms that some entry still has, for completion */
+static char **names;
+static long nnames;
+
+/* the preorder positions of each term's entries, and while building the
+   (term, position) pairs in preorder that they're sorted from. Once
+   built, npairs is the length of post */
+static long *post;
+static long post_alloc;
+static long *pair_term;
+static long *pair_pos;
+static long npairs;
+static long pairs_alloc;
+
+/* the last query's results */
+static long *found_pre;
+static struct tree **found_node;
+static long found_alloc;
+
+/* find the entries below t that have every word of query */
+long tag_query(struct tree *t, const char *query, struct tag_found *found)
+{
+	struct word *w;
+	long first, last, id, pos, k, n = 0;
+	int nwords = 0, len, i, j, best;
+	bool none = false;
+
+	index_tree(find_root(t));
+	/* every word takes at least three chars but the last */
+	w = malloc(sizeof(*w) * (strlen(query) / 3 + 1));
+	first = preorder(t) + 1;
+	last = first + t->ndesc;
+	for (i = 0; query[i] != '\0'; i += len) {
+		if (query[i] == ' ') {
+			len = 1;
+			continue;
+		}
+		if (query[i] != '#' && query[i] != '@') {
+			free(w);
+			return -1;
+		}
+		len = term_end(&query[i]);
+		if (len < 2 || (query[i+len] != '\0' && query[i+len] != ' ')) {
+			free(w);
+			return -1;
+		}
+		if ((id = lookup(&query[i], len)) < 0) {
+			none = true;
+			continue;
+		}
+		/* the part of the term's entries below t */
+		w[nwords].lo = lower_bound(terms[id].first,
+				terms[id].first + terms[id].count, first);
+		w[nwords].hi = lower_bound(w[nwords].lo,
+				terms[id].first + terms[id].count, last);
+		nwords++;
+	}
+	found->n = 0;
+	found->pre = found_pre;
+	found->node = found_node;
+	if (nwords == 0 && !none) {
+		free(w);
+		return -1;
+	} else if (none) {
+		free(w);
+		return 0;
+	}
+
+	/* go through the entries of the rarest word and look up the rest.
+	   The candidates come in order, so each search starts where the
+	   last one for the same word left off */
+	for (i = best = 0; i < nwords; i++) {
+		if (w[i].hi - w[i].lo < w[best].hi - w[best].lo)
+			best = i;
+	}
+	if (found_alloc < w[best].hi - w[best].lo) {
+		found_alloc = w[best].hi - w[best].lo;
+		found_pre = realloc(found_pre, sizeof(*found_pre) * found_alloc);
+		found_node = realloc(found_node,
+				sizeof(*found_node) * found_alloc);
+	}
+	for (k = w[best].lo; k < w[best].hi; k++) {
+		pos = post[k];
+		for (j = 0; j < nwords; j++) {
+			if (j == best)
+				continue;
+			w[j].lo = lower_bound(w[j].lo, w[j].hi, pos);
+			if (w[j].lo == w[j].hi || post[w[j].lo] != pos)
+				break;
+		}
+		if (j == nwords) {
+			found_pre[n] = pos;
+			found_node[n] = order[pos];
+			n++;
+		}
+	}
+	free(w);
+	found->n = n;
+	found->pre = found_pre;
+	found->node = found_node;
+	return n;
+}
+
+/* point *names at every term in t's tree */
+long tag_names(struct tree *t, char ***list)
+{
+	index_tree(find_root(t));
+	*list = names;
+	return nnames;
+}
+
+/* set t's text, moving its entry between the terms of the old text and
+   the new one if its tree is the one indexed and is otherwise as it was
+   indexed */
+void tag_set_text(struct tree *t, char *text)
+{
+	struct tree *r = find_root(t);
+	long pos;
+
+	if (!idx_valid || r != idx_root || tree_links != idx_links
+			|| tree_hash(r) != idx_hash) {
+		set_text(t, text);
+		return;
+	}
+	pos = preorder(t);
+	each_term(t->text, pos, drop_post);
+	set_text(t, text);
+	each_term(t->text, pos, put_post);
+	list_names();
+	idx_hash = tree_hash(r);
+}
+
+/* index t's tree unless it's the one indexed and hasn't changed */
+static void index_tree(struct tree *t)
+{
+	unsigned long hash = tree_hash(t);
+	long i, *count;
+	long pos = 0;
+
+	if (idx_valid && t == idx_root && hash == idx_hash
+			&& tree_links == idx_links)
+		return;
+	idx_valid = false;
+	free(order);
+	free(post);
+	nterms = 0;
+	npairs = 0;
+	block_used = 0;
+	for (i = 0; i < table_size; i++) {
+		table[i] = -1;
+	}
+
+	norder = t->ndesc + 1;
+	order = malloc(sizeof(*order) * norder);
+	number(t, &pos);
+
+	/* a counting sort of the pairs by term keeps each term's
+	   positions in preorder */
+	count = calloc(nterms + 1, sizeof(*count));
+	for (i = 0; i < npairs; i++) {
+		count[pair_term[i]]++;
+	}
+	for (i = pos = 0; i < nterms; i++) {
+		terms[i].first = pos;
+		terms[i].count = count[i];
+		pos += count[i];
+		count[i] = terms[i].first;
+	}
+	post_alloc = npairs + 1;
+	post = malloc(sizeof(*post) * post_alloc);
+	for (i = 0; i < npairs; i++) {
+		post[count[pair_term[i]]++] = pair_pos[i];
+	}
+	free(count);
+	list_names();
+
+	idx_root = t;
+	idx_hash = hash;
+	idx_links = tree_links;
+	idx_valid = true;
+}
+
+/* point names at the text of each term that has entries. The block
+   may have moved since they were last listed */
+static void list_names()
+{
+	long i;
+	free(names);
+	names = malloc(sizeof(*names) * (nterms + 1));
+	for (i = nnames = 0; i < nterms; i++) {
+		if (terms[i].count > 0)
+			names[nnames++] = &block[terms[i].at];
+	}
+}
+
+/* give t and its descendants their positions from *pos on, adding the
+   terms in their text */
+static void number(struct tree *t, long *pos)
+{
+	int i;
+	order[*pos] = t;
+	each_term(t->text, *pos, add_term);
+	(*pos)++;
+	for (i = 0; i < t->nchild; i++) {
+		number(t->child[i], pos);
+	}
+}
+
+/* pass each term in s to use for the entry at pos */
+static void each_term(const char *s, long pos,
+		void (*use)(const char *s, int len, long pos))
+{
+	int i, len, key;
+	for (i = 0; s[i] != '\0'; i++) {
+		if ((s[i] != '#' && s[i] != '@')
+				|| (i > 0 && !isspace((unsigned char)s[i-1])))
+			continue;
+		len = term_end(&s[i]);
+		if (len < 2)
+			continue;
+		if (s[i] == '@') {
+			/* an attribute needs a value, and adds its key too */
+			for (key = 1; is_word(s[i+key]); key++)
+				;
+			if (key < 2 || key + 1 >= len)
+				continue;
+			use(&s[i], key, pos);
+		}
+		use(&s[i], len, pos);
+		i += len - 1;
+	}
+}
+
+/* add len chars of s as a term of the entry at pos, once per entry */
+static void add_term(const char *s, int len, long pos)
+{
+	long id;
+	if (len > MAX_ENTRY_LEN)
+		return;
+	id = intern(s, len);
+	if (terms[id].last == pos)
+		return;
+	terms[id].last = pos;
+	if (npairs == pairs_alloc) {
+		pairs_alloc = pairs_alloc == 0 ? 1024 : pairs_alloc * 2;
+		pair_term = realloc(pair_term, sizeof(*pair_term) * pairs_alloc);
+		pair_pos = realloc(pair_pos, sizeof(*pair_pos) * pairs_alloc);
+	}
+	pair_term[npairs] = id;
+	pair_pos[npairs] = pos;
+	npairs++;
+}
+
+/* add the entry at pos to the built index's list for the term made of
+   len chars of s, in order and once. The lists after it move up one */
+static void put_post(const char *s, int len, long pos)
+{
+	long id, k, i;
+	if (len > MAX_ENTRY_LEN)
+		return;
+	id = intern(s, len);
+	k = lower_bound(terms[id].first, terms[id].first + terms[id].count,
+			pos);
+	if (k < terms[id].first + terms[id].count && post[k] == pos)
+		return;
+	if (npairs == post_alloc) {
+		post_alloc *= 2;
+		post = realloc(post, sizeof(*post) * post_alloc);
+	}
+	memmove(&post[k + 1], &post[k], sizeof(*post) * (npairs - k));
+	post[k] = pos;
+	npairs++;
+	terms[id].count++;
+	for (i = id + 1; i < nterms; i++) {
+		terms[i].first++;
+	}
+}
+
+/* remove the entry at pos from the built index's list for the term made
+   of len chars of s, if it's there. The lists after it move down one */
+static void drop_post(const char *s, int len, long pos)
+{
+	long id, k, i;
+	if ((id = lookup(s, len)) < 0)
+		return;
+	k = lower_bound(terms[id].first, terms[id].first + terms[id].count,
+			pos);
+	if (k == terms[id].first + terms[id].count || post[k] != pos)
+		return;
+	memmove(&post[k], &post[k + 1], sizeof(*post) * (npairs - k - 1));
+	npairs--;
+	terms[id].count--;
+	for (i = id + 1; i < nterms; i++) {
+		terms[i].first--;
+	}
+}
+
+/* return the number of the term made of len chars of s, adding it if
+   it's new */
+static long intern(const char *s, int len)
+{
+	char key[MAX_ENTRY_LEN + 1];
+	long id, i;
+
+	if ((id = lookup(s, len)) >= 0)
+		return id;
+	if (2 * (nterms + 1) > table_size)
+		grow_table();
+	if (nterms == terms_alloc) {
+		terms_alloc = terms_alloc == 0 ? 256 : terms_alloc * 2;
+		terms = realloc(terms, sizeof(*terms) * terms_alloc);
+	}
+	if (block_used + len + 1 > block_size) {
+		block_size = block_size == 0 ? 4096 : block_size * 2;
+		if (block_size < block_used + len + 1)
+			block_size = block_used + len + 1;
+		block = realloc(block, block_size);
+	}
+	id = nterms++;
+	terms[id].at = block_used;
+	terms[id].last = -1;
+	/* a term added to a built index starts with no entries, after
+	   every other term's */
+	terms[id].first = npairs;
+	terms[id].count = 0;
+	memcpy(&block[block_used], s, len);
+	block[block_used + len] = '\0';
+	block_used += len + 1;
+
+	memcpy(key, s, len);
+	key[len] = '\0';
+	for (i = hash_text(key) & (table_size - 1); table[i] >= 0;
+			i = (i + 1) & (table_size - 1))
+		;
+	table[i] = id;
+	return id;
+}
+
+/* return the number of the term made of len chars of s, or -1 */
+static long lookup(const char *s, int len)
+{
+	char key[MAX_ENTRY_LEN + 1];
+	const char *text;
+	long i;
+
+	if (table_size == 0 || len > MAX_ENTRY_LEN)
+		return -1;
+	memcpy(key, s, len);
+	key[len] = '\0';
+	for (i = hash_text(key) & (table_size - 1); table[i] >= 0;
+			i = (i + 1) & (table_size - 1)) {
+		text = &block[terms[table[i]].at];
+		if (strncmp(text, s, len) == 0 && text[len] == '\0')
+			return table[i];
+	}
+	return -1;
+}
+
+/* double the hash table and put every term back in it */
+static void grow_table()
+{
+	long i, j;
+	table_size = table_size == 0 ? 1024 : table_size * 2;
+	table = realloc(table, sizeof(*table) * table_size);
+	for (i = 0; i < table_size; i++) {
+		table[i] = -1;
+	}
+	for (j = 0; j < nterms; j++) {
+		for (i = hash_text(&block[terms[j].at]) & (table_size - 1);
+				table[i] >= 0; i = (i + 1) & (table_size - 1))
+			;
+		table[i] = j;
+	}
+}
+
+/* the length of the tag or attribute s starts with, which is 1 if it's
+   only the '#' or '@' */
+static int term_end(const char *s)
+{
+	int i;
+	for (i = 1; is_word(s[i]); i++)
+		;
+	if (s[0] == '@' && s[i] == '=') {
+		while (s[i] != '\0' && !isspace((unsigned char)s[i]))
+			i++;
+	}
+	return i;
+}
+
+/* whether c can be part of a tag, or of an attribute's key */
+static bool is_word(int c)
+{
+	return isalnum((unsigned char)c) || c == '_' || c == '-' || c == '/';
+}
+
+/* the first of post[lo] to post[hi - 1] at or after pos, or hi */
+static long lower_bound(long lo, long hi, long pos)
+{
+	long mid;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (post[mid] < pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
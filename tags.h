@@ -0,0 +1,40 @@
+#ifndef TT_TAGS_H
+#define TT_TAGS_H
+
+#include "tree.h"
+
+/* Tags and attributes are written in an entry's text, so every file
+   format and plain text reader keeps them as they are. A tag is '#' and
+   a word, such as #oncall, and an attribute is '@', a key, '=' and a
+   value, such as @owner=alice. Either starts the text or follows a space.
+   A word or key is letters, digits, '_', '-' and '/', and a value runs
+   to the next space */
+
+/* The entries found by a query, in preorder. The arrays belong to the
+   index and are reused by the next query */
+struct tag_found {
+	long n;
+	long *pre;             /* each entry's preorder position */
+	struct tree **node;
+};
+
+/* Find the entries below t that have every tag and attribute in query,
+   separated by spaces. "@key" alone matches any value of key. Returns the
+   number found, or -1 if a word of the query isn't a tag or attribute.
+   The tree's index is rebuilt if it changed since the last query, other
+   than by tag_set_text; after that the cost is the entries found for the
+   rarest word, times the log of the entries for each of the others */
+long tag_query(struct tree *t, const char *query, struct tag_found *found);
+
+/* point *names at every tag and attribute in t's tree, including "@key"
+   for each key, and return how many there are */
+long tag_names(struct tree *t, char ***names);
+
+/* set_text for an edit made in the editor. A text edit leaves every
+   other entry where it was, so the index is updated for t alone rather
+   than rebuilt for the whole tree by the next query. Adding, moving or
+   deleting entries shifts the preorder positions the index is kept by,
+   so those still rebuild it */
+void tag_set_text(struct tree *t, char *text);
+
+#endif /* TT_TAGS_H */
@@ -0,0 +1,591 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "exception.h"
+#include "stats.h"
+#include "tree.h"
+
+unsigned long tree_edits;
+unsigned long tree_links;
+struct reshape reshapes[RESHAPE_LOG];
+
+/* FNV-1a parameters for the width of unsigned long */
+#if ULONG_MAX > 0xffffffffUL
+#define HASH_BASIS 14695981039346656037UL
+#define HASH_PRIME 1099511628211UL
+#else
+#define HASH_BASIS 2166136261UL
+#define HASH_PRIME 16777619UL
+#endif
+
+/* static prototypes */
+static void apply_fold(struct tree *t, int levels);
+static void attach_stats(struct tree *p, struct tree *child);
+static void detach_stats(struct tree *p, struct tree *child);
+static enum errcode indent_error(struct reader *rd, const char *msg);
+
+/******************************************************************************
+	Allocate a new node, add it to the parent's list of children,
+	and set its contents to "text"
+*/
+struct tree *add_child(struct tree *parent, char* text)
+{
+	struct tree *tree = NULL;
+	struct tree *child = malloc(sizeof(*child));
+	int len = strlen(text)+1;
+ 	child->nchild = child->nalloc = 0;
+	child->text = malloc(len);
+	memcpy(child->text, text, len);
+	child->text[len-1] = '\0';
+	child->state = EMPTY;
+	child->ndesc = 0;
+	child->height = 0;
+	child->tbytes = len - 1;
+	child->unfold = FOLD_NONE;
+	child->hashed = false;
+	stats.nodes++;
+	stats.text += len;
+	stats.heap += sizeof(*child) + len;
+	return add_leaf(parent, child);
+}
+
+/******************************************************************************
+	Places the given node into the parent node's list of
+	children, allocating space in the parent's list if needed
+*/
+struct tree *add_leaf(struct tree *parent, struct tree *child)
+{
+	child->parent = NULL;
+	if (parent == NULL) {
+		return child;
+	}
+	/* the pending fold is for the children already there */
+	fold_push(parent);
+	if (parent->nalloc == 0) {
+		parent->child = malloc(sizeof(parent->child));
+		parent->nalloc = 1;
+		stats.heap += sizeof(parent->child);
+	} else if (parent->nchild == parent->nalloc) {
+		stats.heap += sizeof(parent->child) * parent->nalloc;
+		parent->nalloc *= 2;
+		parent->child = realloc(parent->child,
+				sizeof(parent->child) * parent->nalloc);
+	}
+	parent->child[parent->nchild++] = child;
+	parent->state = EXPANDED;
+	child->parent = parent;
+	attach_stats(parent, child);
+	hash_dirty(parent);
+	tree_links++;
+	reshaped(parent, parent->nchild - 1);
+	return child;
+}
+
+/******************************************************************************
+	Add a newly attached child's subtree to the aggregates of its parent
+	p and p's ancestors
+*/
+static void attach_stats(struct tree *p, struct tree *child)
+{
+	int h = child->height + 1;
+	for (; p != NULL; p = p->parent, h++) {
+		p->ndesc += child->ndesc + 1;
+		p->tbytes += child->tbytes;
+		if (p->height < h)
+			p->height = h;
+	}
+}
+
+/******************************************************************************
+	Remove a detached child's subtree from the aggregates of its old
+	parent p and p's ancestors. Heights are recomputed from the remaining
+	children until one doesn't change
+*/
+static void detach_stats(struct tree *p, struct tree *child)
+{
+	bool height = true;
+	int h, i;
+	for (; p != NULL; p = p->parent) {
+		p->ndesc -= child->ndesc + 1;
+		p->tbytes -= child->tbytes;
+		if (!height)
+			continue;
+		h = 0;
+		for (i = 0; i < p->nchild; i++) {
+			if (p->child[i]->height + 1 > h)
+				h = p->child[i]->height + 1;
+		}
+		height = h != p->height;
+		p->height = h;
+	}
+}
+
+/******************************************************************************
+	Expand t so that levels levels below it show, collapsing everything
+	deeper, or collapse it when levels is 0. Only t is written here; its
+	descendants take their state from the pending fold as they are
+	visited, so folding a huge branch costs the same as a small one
+*/
+void fold_subtree(struct tree *t, int levels)
+{
+	apply_fold(t, levels);
+	reshaped(t, 0);
+}
+
+/******************************************************************************
+	Apply t's pending fold to its children, handing it on one level
+	shallower. Anything reading a child's state calls this first
+*/
+void fold_push(struct tree *t)
+{
+	int i, levels;
+	if (t->unfold == FOLD_NONE)
+		return;
+	levels = t->unfold == FOLD_ALL ? FOLD_ALL
+		: t->unfold > 0 ? t->unfold - 1 : 0;
+	for (i = 0; i < t->nchild; i++) {
+		apply_fold(t->child[i], levels);
+	}
+	t->unfold = FOLD_NONE;
+}
+
+/******************************************************************************
+	Set t's state and pending fold. Pushing a fold down doesn't change
+	what shows, so unlike fold_subtree this isn't counted as a change
+*/
+static void apply_fold(struct tree *t, int levels)
+{
+	if (t->nchild > 0)
+		t->state = levels > 0 ? EXPANDED : COLLAPSED;
+	t->unfold = levels;
+}
+
+/******************************************************************************
+	Apply the pending folds of t's ancestors from the root down, so
+	that t's own state is current
+*/
+void fold_settle(struct tree *t)
+{
+	if (t->parent == NULL)
+		return;
+	fold_settle(t->parent);
+	fold_push(t->parent);
+}
+
+/******************************************************************************
+	Count a change to parent's children or fold, logging where it starts
+*/
+void reshaped(struct tree *parent, int index)
+{
+	reshapes[tree_edits % RESHAPE_LOG].parent = parent;
+	reshapes[tree_edits % RESHAPE_LOG].index = index;
+	tree_edits++;
+}
+
+/******************************************************************************
+	Replace t's children with the n nodes in child, which may include
+	some of its current children, in one pass rather than a del_child
+	and add_leaf per node. Children left out are unlinked but not freed
+*/
+void set_children(struct tree *t, struct tree **child, int n)
+{
+	long ndesc = 0, tbytes = strlen(t->text);
+	int height = 0, h, i;
+	bool taller;
+	struct tree *p;
+
+	/* the pending fold is for the children already there */
+	fold_push(t);
+	for (i = 0; i < t->nchild; i++) {
+		t->child[i]->parent = NULL;
+	}
+	if (n > t->nalloc) {
+		stats.heap += sizeof(*t->child) * (n - t->nalloc);
+		/* child isn't set until something is allocated */
+		t->child = t->nalloc == 0 ? malloc(sizeof(*t->child) * n)
+			: realloc(t->child, sizeof(*t->child) * n);
+		t->nalloc = n;
+	}
+	for (i = 0; i < n; i++) {
+		t->child[i] = child[i];
+		child[i]->parent = t;
+		ndesc += child[i]->ndesc + 1;
+		tbytes += child[i]->tbytes;
+		if (child[i]->height + 1 > height)
+			height = child[i]->height + 1;
+	}
+	t->nchild = n;
+	if (n > 0 && t->state == EMPTY)
+		t->state = EXPANDED;
+
+	/* hand the change in size up to the ancestors */
+	taller = height != t->height;
+	ndesc -= t->ndesc;
+	tbytes -= t->tbytes;
+	t->ndesc += ndesc;
+	t->tbytes += tbytes;
+	t->height = height;
+	for (p = t->parent; p != NULL; p = p->parent) {
+		p->ndesc += ndesc;
+		p->tbytes += tbytes;
+		if (!taller)
+			continue;
+		h = 0;
+		for (i = 0; i < p->nchild; i++) {
+			if (p->child[i]->height + 1 > h)
+				h = p->child[i]->height + 1;
+		}
+		taller = h != p->height;
+		p->height = h;
+	}
+	hash_dirty(t);
+	tree_links++;
+	reshaped(t, 0);
+}
+
+/******************************************************************************
+	Remove a child from its parent and return a pointer
+	to the removed node. Returns NULL if node was not found.
+*/
+struct tree *del_child(struct tree *child)
+{
+	int i, j;
+	struct tree *tree = NULL;
+	if (child == NULL)
+		return NULL;
+	tree = child->parent;
+	if (tree == NULL)
+		return NULL;
+	for (i = 0; i < tree->nchild; i++) {
+		if (tree->child[i] == child) {
+			for (j = i; j < tree->nchild-1; j++) {
+				tree->child[j] = tree->child[j+1];
+			}
+			tree->nchild--;
+			child->parent = NULL;
+			detach_stats(tree, child);
+			hash_dirty(tree);
+			tree_links++;
+			reshaped(tree, i);
+			return child;
+		}
+	}
+	return NULL;
+}
+
+/******************************************************************************
+	Release the memory used by a tree and its children
+*/
+void free_tree(struct tree *t)
+{
+	int i;
+	for (i = 0; i < t->nchild; i++) {
+		free_tree(t->child[i]);
+	}
+	free_node(t);
+}
+
+/******************************************************************************
+	Release a single node whose children have been moved or freed
+*/
+void free_node(struct tree *t)
+{
+	int len = strlen(t->text) + 1;
+	stats.nodes--;
+	stats.text -= len;
+	stats.heap -= sizeof(*t) + len + sizeof(t->child) * t->nalloc;
+	if (t->nalloc > 0)
+		free(t->child);
+	free(t->text);
+	free(t);
+}
+
+/******************************************************************************
+	Replace a node's text with the malloc'd string text, which the
+	node takes ownership of
+*/
+void set_text(struct tree *t, char *text)
+{
+	int delta = (int)strlen(text) - (int)strlen(t->text);
+	struct tree *p;
+	stats.text += delta;
+	stats.heap += delta;
+	for (p = t; p != NULL; p = p->parent) {
+		p->tbytes += delta;
+	}
+	free(t->text);
+	t->text = text;
+	hash_dirty(t);
+}
+
+/******************************************************************************
+	Return the hash of t's text and its children's hashes. Only nodes
+	whose hash was cleared are visited, which after an edit is the path
+	from the edit to the root
+*/
+unsigned long tree_hash(struct tree *t)
+{
+	unsigned long h;
+	int i;
+	if (t->hashed)
+		return t->hash;
+	h = hash_text(t->text);
+	for (i = 0; i < t->nchild; i++) {
+		/* mix each child in so order and nesting both count */
+		h ^= tree_hash(t->child[i]) + 0x9e3779b9UL + (h << 6) + (h >> 2);
+		h *= HASH_PRIME;
+	}
+	t->hash = h;
+	t->hashed = true;
+	return h;
+}
+
+/******************************************************************************
+	Clear the hashes of t and its ancestors. An ancestor of a cleared
+	node is always cleared too, so the walk stops at the first one
+*/
+void hash_dirty(struct tree *t)
+{
+	t->hashed = false;
+	for (t = t->parent; t != NULL && t->hashed; t = t->parent) {
+		t->hashed = false;
+	}
+}
+
+/******************************************************************************
+	FNV-1a hash of a string
+*/
+unsigned long hash_text(const char *s)
+{
+	unsigned long h = HASH_BASIS;
+	while (*s != '\0') {
+		h ^= (unsigned char)*s++;
+		h *= HASH_PRIME;
+	}
+	return h;
+}
+
+/******************************************************************************
+	Return the topmost node connected to leaf
+*/
+struct tree *find_root(struct tree *leaf)
+{
+	if (leaf->parent == NULL)
+		return leaf;
+	return find_root(leaf->parent);
+}
+
+/******************************************************************************
+	Return t's position in a preorder walk from its root, which is 0.
+	Each earlier sibling on the way up is skipped whole using ndesc
+*/
+long preorder(struct tree *t)
+{
+	struct tree *p;
+	long pos = 0;
+	int i;
+	for (; t->parent != NULL; t = p) {
+		p = t->parent;
+		for (i = 0; p->child[i] != t; i++) {
+			pos += p->child[i]->ndesc + 1;
+		}
+		pos++;
+	}
+	return pos;
+}
+
+/******************************************************************************
+	Write a tree recursively to file
+*/
+void write_tree(struct tree *t, FILE *f, int depth)
+{
+	int i;
+	for (i = 0; i < depth; i++) {
+		putc('\t', f);
+	}
+	fputs(t->text, f);
+	putc('\n', f);
+	for (i = 0; i < t->nchild; i++) {
+		write_tree(t->child[i], f, depth+1);
+	}
+}
+
+/******************************************************************************
+	Prepare a reader for f and read in the first line
+*/
+enum errcode reader_init(struct reader *rd, FILE *f)
+{
+	memset(rd, 0, sizeof(*rd));
+	rd->f = f;
+	rd->select = -1;
+	return next_line(rd);
+}
+
+/******************************************************************************
+	Record an error at the current line and return it. Only the first
+	error is kept, and the reader stops there
+*/
+enum errcode reader_error(struct reader *rd, enum errcode err,
+		const char *msg)
+{
+	if (rd->err == ERR_NONE) {
+		rd->err = err;
+		rd->msg = msg;
+		rd->column = rd->indent + 1;
+	}
+	rd->have = false;
+	return rd->err;
+}
+
+/******************************************************************************
+	Report a mis-indented line. In recovery mode it is recorded and
+	reading continues, otherwise it stops the reader
+*/
+static enum errcode indent_error(struct reader *rd, const char *msg)
+{
+	struct problem *p;
+
+	if (!rd->recover)
+		return reader_error(rd, ERR_FORMAT, msg);
+	if (rd->nproblems == rd->problems_alloc) {
+		rd->problems_alloc = rd->problems_alloc > 0
+			? rd->problems_alloc * 2 : 16;
+		rd->problems = realloc(rd->problems,
+				sizeof(*rd->problems) * rd->problems_alloc);
+	}
+	p = &rd->problems[rd->nproblems++];
+	p->line = rd->line;
+	p->column = rd->indent + 1;
+	p->msg = msg;
+	return ERR_NONE;
+}
+
+/******************************************************************************
+	Release the problems recorded in recovery mode
+*/
+void reader_free(struct reader *rd)
+{
+	free(rd->problems);
+	rd->problems = NULL;
+	rd->nproblems = rd->problems_alloc = 0;
+}
+
+/******************************************************************************
+	Read the next line, counting its indentation. If the indent character
+	hasn't been decided yet it is set to the first whitespace character
+	encountered at the beginning of a line. When indenting with spaces,
+	the first indent decides how many make up one level. Text beyond
+	MAX_ENTRY_LEN is discarded. The reader is the only thing reading f,
+	so it skips stdio's locking.
+*/
+enum errcode next_line(struct reader *rd)
+{
+	int c;
+	int count = 0;
+
+	if (rd->err != ERR_NONE)
+		return rd->err;
+	c = getc_unlocked(rd->f);
+	rd->depth = 0;
+	rd->len = 0;
+	rd->text[0] = '\0';
+	if (c == EOF) {
+		rd->have = false;
+		if (ferror(rd->f))
+			return reader_error(rd, ERR_IO, strerror(errno));
+		return ERR_NONE;
+	}
+	if (rd->delim == '\0' && (c == ' ' || c == '\t'))
+		rd->delim = c;
+	while (c == rd->delim && c != '\0') {
+		count++;
+		c = getc_unlocked(rd->f);
+	}
+	rd->line++;
+	rd->indent = count;
+	rd->depth = count;
+	if (count > 0 && rd->delim == ' ') {
+		if (rd->width == 0)
+			rd->width = count;
+		/* when recovering, round down to the enclosing level */
+		if (count % rd->width != 0
+				&& indent_error(rd, "indent is not a multiple "
+					"of the first indent") != ERR_NONE)
+			return rd->err;
+		rd->depth = count / rd->width;
+	}
+	while (c != '\n' && c != EOF) {
+		if (rd->len < MAX_ENTRY_LEN - 1)
+			rd->text[rd->len++] = c;
+		c = getc_unlocked(rd->f);
+	}
+	rd->text[rd->len] = '\0';
+	rd->have = true;
+	return ERR_NONE;
+}
+
+/******************************************************************************
+	Read the node on the current line and, recursively, every following
+	line indented deeper than it. On error the partly read subtree is
+	freed and *out is set to NULL
+*/
+enum errcode read_tree(struct reader *rd, int indent, struct tree **out)
+{
+	struct tree *t, *child;
+	enum fold_state state = COLLAPSED;
+	enum errcode err;
+	bool moved = false;
+
+	*out = NULL;
+	/* ensure consistent indentation. A line can only start too deep,
+	   which recovery fixes by reading it at indent */
+	if (rd->depth != indent) {
+		if (indent_error(rd, "invalid indentation") != ERR_NONE)
+			return rd->err;
+		rd->depth = indent;
+		moved = true;
+	}
+	t = add_child(NULL, rd->text);
+
+	/* restore the fold and selection saved by a previous session */
+	if (rd->folds != NULL) {
+		if (getc(rd->folds) == '-')
+			state = EXPANDED;
+		if (rd->count == rd->select)
+			rd->selected = t;
+		rd->count++;
+	}
+
+	err = next_line(rd);
+	/* a moved line takes no children: the lines after it are measured
+	   against the last correctly indented one, so each that is too deep
+	   is moved and reported in turn rather than nested under it */
+	while (!moved && err == ERR_NONE && rd->have && rd->depth > indent) {
+		if ((err = read_tree(rd, indent+1, &child)) == ERR_NONE)
+			add_leaf(t, child);
+	}
+	if (err != ERR_NONE) {
+		free_tree(t);
+		return err;
+	}
+	t->state = state;
+	*out = t;
+	return ERR_NONE;
+}
+
+/******************************************************************************
+	Read every remaining top level entry as children of parent. On error
+	the entries read so far are left in parent
+*/
+enum errcode read_forest(struct reader *rd, struct tree *parent)
+{
+	struct tree *t;
+	enum errcode err = rd->err;
+
+	while (err == ERR_NONE && rd->have) {
+		if ((err = read_tree(rd, 0, &t)) == ERR_NONE)
+			add_leaf(parent, t);
+	}
+	return err;
+}
@@ -0,0 +1,183 @@
+#ifndef TT_TREE_H
+#define TT_TREE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <limits.h>
+
+#include "exception.h"
+
+/* maximum length of an entry's text */
+#define MAX_ENTRY_LEN 256
+
+enum fold_state {
+	EMPTY,
+	EXPANDED,
+	COLLAPSED
+};
+
+/* values of a node's unfold besides a number of levels */
+#define FOLD_NONE -1       /* nothing pending */
+#define FOLD_ALL INT_MAX   /* expand every level */
+
+struct tree {
+	int nchild;
+	int nalloc;
+	struct tree *parent;
+	struct tree **child;
+	struct tree *sibling; /* TODO: use a linked list instead of array for child nodes */
+	enum fold_state state;
+	char* text;
+	/* aggregates of the subtree, kept up to date by add_leaf, del_child
+	   and set_text so that a branch's size is known without walking it */
+	long ndesc;     /* number of descendants */
+	int height;     /* levels of descendants below this node */
+	long tbytes;    /* bytes of text in this node and its descendants */
+	/* a fold of the whole subtree not yet applied to the descendants:
+	   the number of levels below this node to show, or FOLD_NONE. It is
+	   pushed one level down by fold_push as the children are visited */
+	int unfold;
+	/* hash of the text and the children's hashes in order, so different
+	   hashes mean different subtrees. Edits only clear hashed on the path
+	   to the root, and tree_hash recomputes what was cleared */
+	unsigned long hash;
+	bool hashed;
+};
+
+/* A problem fixed while reading in recovery mode */
+struct problem {
+	long line;
+	int column;
+	const char *msg;
+};
+
+/* Reads a tree file one line at a time without seeking, so it also
+   works on pipes. Always holds the next unconsumed line. */
+struct reader {
+	FILE *f;
+	char delim;     /* indent character, '\0' until the first indent */
+	int width;      /* spaces per level, decided by the first indent */
+	bool have;      /* false once the input is exhausted */
+	int depth;      /* indentation of the current line */
+	int indent;     /* indent characters before the current line's text */
+	long line;      /* number of the current line */
+	int column;     /* column of the first error */
+	enum errcode err; /* first error, after which the reader stops */
+	const char *msg;  /* description of err */
+	/* in recovery mode mis-indented lines are attached to the nearest
+	   valid parent, and each one is recorded instead of stopping */
+	bool recover;
+	struct problem *problems;
+	int nproblems;
+	int problems_alloc;
+	int len;        /* length of text */
+	char text[MAX_ENTRY_LEN];
+	/* optional fold markers to restore, one per node in preorder */
+	FILE *folds;
+	long count;     /* preorder index of the next node read */
+	long select;    /* preorder index of the node to report in selected */
+	struct tree *selected;
+};
+
+/* bumped by every change to the shape of a tree or to its folds, so that
+   views built from a tree can tell when they are stale. Code outside
+   tree.c that reorders children or sets a state calls reshaped */
+extern unsigned long tree_edits;
+
+/* bumped only when nodes are linked into or unlinked from a tree, so
+   anything holding node pointers by position can tell they may be stale
+   without being thrown away by folds */
+extern unsigned long tree_links;
+
+/* Where a change counted by tree_edits was made: the node whose children
+   or fold changed, and the first child that may show differently. A view
+   keeps whatever it shows before that. The log is a ring holding the last
+   RESHAPE_LOG changes, change n in reshapes[n % RESHAPE_LOG], so any
+   number of views can each catch up from the count they were built at */
+#define RESHAPE_LOG 64
+struct reshape {
+	struct tree *parent;
+	int index;
+};
+
+extern struct reshape reshapes[RESHAPE_LOG];
+
+/* count a change to parent's children or fold from child index on */
+void reshaped(struct tree *parent, int index);
+
+/* allocate a node holding a copy of text and append it to parent */
+struct tree *add_child(struct tree *parent, char* text);
+
+/* append an existing node to parent's children */
+struct tree *add_leaf(struct tree *parent, struct tree *child);
+
+/* replace t's children with the n nodes in child, which may include some
+   of its current children. Children left out are unlinked, not freed */
+void set_children(struct tree *t, struct tree **child, int n);
+
+/* unlink child from its parent, returning it or NULL if not found */
+struct tree *del_child(struct tree *child);
+
+/* expand t so that levels levels below it show, collapsing the rest, or
+   collapse it with 0. Descendants are updated lazily by fold_push */
+void fold_subtree(struct tree *t, int levels);
+
+/* apply t's pending fold to its children; call before reading their state */
+void fold_push(struct tree *t);
+
+/* apply the pending folds of t's ancestors down to t */
+void fold_settle(struct tree *t);
+
+/* return t's subtree hash, recomputing any parts edited since */
+unsigned long tree_hash(struct tree *t);
+
+/* clear the hashes of t and its ancestors; call after reordering t's
+   children without going through the functions here */
+void hash_dirty(struct tree *t);
+
+/* FNV-1a hash of a string */
+unsigned long hash_text(const char *s);
+
+/* return the topmost ancestor of leaf */
+struct tree *find_root(struct tree *leaf);
+
+/* return t's position in a preorder walk from its root, which is 0. The
+   cost is the number of earlier siblings of t and its ancestors */
+long preorder(struct tree *t);
+
+/* release a node and all of its descendants */
+void free_tree(struct tree *t);
+
+/* release a single node, ignoring any children it still lists */
+void free_node(struct tree *t);
+
+/* replace t's text with text, a malloc'd string t takes ownership of */
+void set_text(struct tree *t, char *text);
+
+/* The reader functions return ERR_NONE or the first error, which is
+   also kept in the reader along with the line it was found on */
+
+/* prepare rd to read from f and read in the first line */
+enum errcode reader_init(struct reader *rd, FILE *f);
+
+/* record an error at the current line, returning the first one */
+enum errcode reader_error(struct reader *rd, enum errcode err,
+		const char *msg);
+
+/* release the problems recorded in recovery mode */
+void reader_free(struct reader *rd);
+
+/* advance to the next line; have is false at end of input */
+enum errcode next_line(struct reader *rd);
+
+/* read the node on the current line and all of its descendants into *t,
+   freeing anything read if there's an error */
+enum errcode read_tree(struct reader *rd, int indent, struct tree **t);
+
+/* read the remaining top level entries as children of parent */
+enum errcode read_forest(struct reader *rd, struct tree *parent);
+
+/* write a node and its descendants as tab indented lines */
+void write_tree(struct tree *t, FILE *f, int depth);
+
+#endif /* TT_TREE_H */
@@ -3,108 +3,51 @@
 #include <string.h>
 #include <locale.h>
 #include <stdbool.h>
-#include <setjmp.h>
 #include <errno.h>
-
+#include <ctype.h>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "autosave.h"
+#include "complete.h"
 #include "exception.h"
+#include "export.h"
 #include "readline.h"
+#include "render.h"
+#include "sort.h"
+#include "stats.h"
+#include "tags.h"
+#include "tree.h"
+#include "tt.h"
 
 /******************************************************************************
 TODO:
 	Add means to view entries that don't fit onscreen
 	Handle horizontal scrolling
 	Show filename in "say" messages
-	Listen for resize signal
 	Handle Ctrl+Z signal
 	Alphabetize functions
 	Check Delete edge cases for crashes
 	Check for memory leaks with valgrind
-	Tab complete for filenames
 */
 
-/* Program info displayed in status bar */
-#define PROGRAM "tree tool"
-#define VERSION "v0.2"
-
-/* Size in rows of footer sections */
-#define HELP_SIZE 2
-#define STATUS_SIZE 1
-
-/* Set to 0 to hide help on startup*/
-#define SHOW_HELP_DEFAULT 0
-
-#define MAX_ENTRY_LEN 256
-
-/* Duration of blink in ms */
-#define SAY_DURATION 96 
-#define SAY_BLINKS 2
-#define MAX_SAY_CHARS 40
-
-enum fold_state {
-	EMPTY,
-	EXPANDED,
-	COLLAPSED
-};
-
-struct tree {
-	int nchild;
-	int nalloc;
-	struct tree *parent;
-	struct tree **child;
-	struct tree *sibling; /* TODO: use a linked list instead of array for child nodes */
-	enum fold_state state;
-	char* text;
-};
-
-/* function prototypes */
-bool confirm(const char *question);
-bool modified_warning();
-char *prompt(const char *msgstr, const char *defstr);
-int main(int argc, char *argv[]);
-struct tree *add_child(struct tree *parent, char* text);
-struct tree *add_leaf(struct tree *parent, struct tree *child);
-struct tree *del_child(struct tree *child);
-struct tree *find_root(struct tree *leaf);
-struct tree *read_tree(FILE *f, char delim, int depth);
-void delete();
-void demote();
-void die(const char *error);
-void draw_info(int y, int x, const char *key, const char *label);
-void edit_entry();
-void free_tree(struct tree *t);
-void help_normal();
-void help_edit();
-void init_curses();
-void insert_entry();
-bool load(const char *fname);
-void menu();
-void print_tree(struct tree *tree, int depth);
-void promote();
-void redraw();
-void resize();
-void save();
-void saveas(const char *fname);
-void say(const char *str);
-void select_down();
-void select_up();
-void set_fold(enum fold_state f);
-WINDOW *set_window(WINDOW *win, int h, int w, int y, int x);
-void shove_down();
-void shove_up();
-void status();
-void write_tree(struct tree *t, FILE *f, int depth);
-
 /******************************************************************************
    Globals
 */
 
-/* curses windows for each UI section */
-WINDOW *tree_window;
-WINDOW *status_window;
-WINDOW *help_window;
+/* surfaces for each UI section */
+struct surface tree_view;
+struct surface status_view;
+struct surface help_view;
+struct surface stats_view;
 
+int tree_area_height;
 int tree_win_height;
+int tree_win_width;
 int status_win_height;
+int stats_win_height;
 int help_win_height;
 int input_win_height;
 
@@ -113,188 +56,622 @@ int vscroll;
 int printed_lines;
 int selected_index;
 
-enum {
-	H_HIDE,
-	H_NORMAL,
-	H_EDIT
-} help_mode;
+enum help_mode help_mode;
+bool show_stats;
+/* whether the terminal was asked to mark pasted text */
+bool paste_on;
+
+/* the last tag query, which n and N go on finding */
+char find_query[MAXLEN + 1];
+
+/* if set, prompt() returns its answers instead of reading the keyboard */
+char *(*prompt_source)(const char *msgstr, const char *defstr);
+
+/* the panes the tree is split into; only panes[0] is used unsplit */
+struct pane panes[MAX_PANES];
+int npanes = 1;
+int current_pane;
+enum split split;
+
+/* every row of the expanded tree in display order, shared by the panes
+   that have no folds of their own. It is filled in only as far as a pane
+   has needed. When the tree or its folds change, the rows from the first
+   change logged in reshapes on are dropped and filled in again, and it
+   starts over if the log no longer reaches back to when it was last
+   brought up to date. These globals hold the index the focused pane
+   uses; view_home is where they're kept when it changes */
+struct tree **view_rows;
+int *view_depth;
+long view_nrows;
+long view_alloc;
+struct row_frame *view_stack;
+int view_nstack;
+int view_stack_alloc;
+unsigned long view_edits;
+struct tree *view_root;
+struct row_index shared_rows;
+struct row_index *view_home = &shared_rows;
 
 struct tree **onscreen_entries;
+int onscreen_alloc;
 struct tree *selected_entry;
 struct tree *root;
 
 unsigned char int_size = sizeof(int);
 
 char filename[MAX_ENTRY_LEN];
-bool modified;
+/* root hash of the open file as last loaded or saved */
+unsigned long saved_hash;
+/* true while the tree holds fixes made to the file's indentation on
+   load, which count as unsaved changes until it is saved */
+bool repaired;
+/* root hash of the tree as last written to the recovery file, the edits
+   since then and when the last key came */
+unsigned long recover_hash;
+long unsaved_edits;
+double last_input;
+
+/* the open file as it was last loaded or saved, and as it was when a
+   change on disk was last noticed */
+struct file_stamp disk_stamp;
+struct file_stamp seen_stamp;
+
+/* every open document, including the current one */
+struct buffer *buffers;
+int nbuffers;
+int buffers_alloc;
+int current_buffer;
 
 char saymsg[MAX_SAY_CHARS];
 int sayblink;
 
+/* the nodes whose children the last sort reordered, and a copy of their
+   children from before it, concatenated, so the sort can be undone */
+struct tree **undo_nodes;
+struct tree **undo_kids;
+long undo_nnodes;
+
+/* preorder counters used while writing the fold / cursor state file */
+long state_count;
+long state_select;
+
+/******************************************************************************
+	Print an error and quit
+*/
+void die(const char *error)
+{
+	char rname[MAX_ENTRY_LEN + sizeof(RECOVER_SUFFIX) + 16];
+	static bool dying;
+	FILE *f;
+	int i, j;
+
+	paste_mode(false);
+	endwin();
+	fprintf(stderr, "=====================================\n");
+	fprintf(stderr, "                ERROR                \n");
+	fprintf(stderr, "-------------------------------------\n");
+	fprintf(stderr, "%s\n", error);
+	fprintf(stderr, "=====================================\n");
+
+	/* write out every buffer with unsaved changes on this thread, unless
+	   that is what failed */
+	if (!dying && root != NULL) {
+		dying = true;
+		autosave_stop();
+		store_buffer();
+		for (i = 0; i < nbuffers; i++) {
+			struct buffer *b = &buffers[i];
+			if (b->root == NULL || tree_hash(b->root) == b->saved_hash)
+				continue;
+			recover_name(b->filename, rname);
+			if ((f = fopen(rname, "w")) == NULL)
+				continue;
+			for (j = 0; j < b->root->nchild; j++) {
+				write_tree(b->root->child[j], f, 0);
+			}
+			if (fclose(f) == 0)
+				fprintf(stderr, "Unsaved changes kept in %s\n", rname);
+		}
+	}
+	exit(1);
+}
+
 /******************************************************************************
-	Allocate a new node, add it to the parent's list of children,
-	and set its contents to "text"
+	Swallow the rest of a burst of resize events, such as those sent while
+	dragging a terminal edge. The first key that isn't a resize event is
+	pushed back for later.
 */
-struct tree *add_child(struct tree *parent, char* text)
+void settle_resize(WINDOW *win)
 {
-	struct tree *tree = NULL;
-	struct tree *child = malloc(sizeof(*child));
-	int len = strlen(text)+1;
- 	child->nchild = child->nalloc = 0;
-	child->text = malloc(len);
-	memcpy(child->text, text, len);
-	child->text[len-1] = '\0';
-	child->state = EMPTY;
-	return add_leaf(parent, child);
+	int c;
+	wtimeout(win, RESIZE_SETTLE);
+	do {
+		c = wgetch(win);
+	} while (c == KEY_RESIZE);
+	wtimeout(win, -1);
+	if (c != ERR)
+		ungetch(c);
 }
 
 /******************************************************************************
-	Places the given node into the parent node's list of
-	children, allocating space in the parent's list if needed
+	Query terminal for size and update windows accordingly
 */
-struct tree *add_leaf(struct tree *parent, struct tree *child)
+void resize()
 {
-	child->parent = NULL;
-	if (parent == NULL) {
-		return child;
+	int focus = current_pane;
+	int i, h, w, y, x;
+
+	r_screen(&screenh, &screenw);
+	status_win_height = STATUS_SIZE;
+	help_win_height = help_mode == H_HIDE ? 0 : HELP_SIZE;
+	stats_win_height = show_stats ? STATS_SIZE : 0;
+	tree_area_height = screenh - (status_win_height + help_win_height
+			+ stats_win_height + input_win_height);
+	if (tree_area_height < 0)
+		tree_area_height = 0;
+	/* keep a table of onscreen entries to map cursor row to struct ptr,
+	   only growing it so that repeated resizes don't churn the heap */
+	if (tree_area_height > onscreen_alloc) {
+		onscreen_entries = realloc(onscreen_entries,
+				sizeof(*onscreen_entries) * tree_area_height);
+		onscreen_alloc = tree_area_height;
+	}
+	/* lay out each pane, making it current while it's placed */
+	store_pane();
+	for (i = 0; i < npanes; i++) {
+		restore_pane(i);
+		pane_rect(i, &h, &w, &y, &x);
+		tree_win_height = h;
+		tree_win_width = w;
+		/* keep the selection anchored onscreen if the pane shrank */
+		if (selected_index >= tree_win_height && tree_win_height > 0) {
+			vscroll += selected_index - tree_win_height + 1;
+			selected_index = tree_win_height - 1;
+		}
+		r_place(&tree_view, h, w, y, x);
+		store_pane();
 	}
-	if (parent->nalloc == 0) {
-		parent->child = malloc(sizeof(parent->child));
-		parent->nalloc = parent->nchild = 1;
-		parent->child[0] = child;
-		parent->state = EXPANDED;
-		child->parent = parent;
-		return child;
+	restore_pane(focus);
+	/* create new status window of correct size */
+	r_place(&status_view, status_win_height, screenw,
+			screenh - help_win_height - status_win_height, 0);
+	/* if enabled, the stats overlay sits just above the status bar */
+	if (show_stats) {
+		r_place(&stats_view, stats_win_height, screenw,
+				screenh - help_win_height - status_win_height
+				- stats_win_height, 0);
+	} else {
+		r_remove(&stats_view);
 	}
-	if (parent->nchild < parent->nalloc) {
-		parent->child[parent->nchild++] = child;
-		parent->state = EXPANDED;
-		child->parent = parent;
-		return child;
+	/* if visible, create new help window of correct size */
+	if (help_mode != H_HIDE) {
+		r_place(&help_view, help_win_height, screenw,
+				screenh - help_win_height, 0);
+	} else {
+		r_remove(&help_view);
 	}
-	parent->nalloc *= 2;
-	parent->child = realloc(parent->child,
-			sizeof(parent->child) * parent->nalloc);
-	parent->child[parent->nchild++] = child;
-	parent->state = EXPANDED;
-	child->parent = parent;
-	return child;
 }
 
 /******************************************************************************
-	Remove a child from its parent and return a pointer
-	to the removed node. Returns NULL if node was not found.
+	Store the size and position of pane i in the tree area. Side by side
+	panes leave a blank column between them
 */
-struct tree *del_child(struct tree *child)
+void pane_rect(int i, int *h, int *w, int *y, int *x)
 {
-	int i, j;
-	struct tree *tree = NULL;
-	if (child == NULL)
-		return NULL;
-	tree = child->parent;
-	if (tree == NULL)
-		return NULL;
-	for (i = 0; i < tree->nchild; i++) {
-		if (tree->child[i] == child) {
-			for (j = i; j < tree->nchild-1; j++) {
-				tree->child[j] = tree->child[j+1];
+	*h = tree_area_height;
+	*w = screenw;
+	*y = *x = 0;
+	if (split == SPLIT_SIDE) {
+		*w = screenw / 2;
+		if (i == 1) {
+			*x = *w;
+			*w = screenw - *w;
+		} else if (*w > 0) {
+			(*w)--;
+		}
+	} else if (split == SPLIT_STACK) {
+		*h = tree_area_height / 2;
+		if (i == 1) {
+			*y = *h;
+			*h = tree_area_height - *h;
+		}
+	}
+}
+
+/******************************************************************************
+	Copy the focused pane's globals into its slot
+*/
+void store_pane()
+{
+	struct pane *p = &panes[current_pane];
+	p->view = tree_view;
+	p->selected = selected_entry;
+	p->vscroll = vscroll;
+	p->selected_index = selected_index;
+	p->height = tree_win_height;
+	p->width = tree_win_width;
+}
+
+/******************************************************************************
+	Make pane i current without storing the focused one
+*/
+void restore_pane(int i)
+{
+	struct pane *p = &panes[i];
+	current_pane = i;
+	tree_view = p->view;
+	selected_entry = p->selected;
+	vscroll = p->vscroll;
+	selected_index = p->selected_index;
+	tree_win_height = p->height;
+	tree_win_width = p->width;
+	use_rows(pane_rows(i));
+}
+
+/******************************************************************************
+	Return the row index pane i draws from: the shared one, unless it
+	has folds of its own
+*/
+struct row_index *pane_rows(int i)
+{
+	return panes[i].folds.n > 0 ? &panes[i].rows : &shared_rows;
+}
+
+/******************************************************************************
+	Put the row index in the view_ globals back where it came from and
+	load ix in its place
+*/
+void use_rows(struct row_index *ix)
+{
+	struct row_index *home = view_home;
+	if (ix == home)
+		return;
+	home->rows = view_rows;
+	home->depth = view_depth;
+	home->nrows = view_nrows;
+	home->alloc = view_alloc;
+	home->stack = view_stack;
+	home->nstack = view_nstack;
+	home->stack_alloc = view_stack_alloc;
+	home->edits = view_edits;
+	home->root = view_root;
+	view_rows = ix->rows;
+	view_depth = ix->depth;
+	view_nrows = ix->nrows;
+	view_alloc = ix->alloc;
+	view_stack = ix->stack;
+	view_nstack = ix->nstack;
+	view_stack_alloc = ix->stack_alloc;
+	view_edits = ix->edits;
+	view_root = ix->root;
+	view_home = ix;
+}
+
+/******************************************************************************
+	Release a row index kept aside
+*/
+void free_rows(struct row_index *ix)
+{
+	free(ix->rows);
+	free(ix->stack);
+	free(ix->depth);
+	memset(ix, 0, sizeof(*ix));
+}
+
+/******************************************************************************
+	Split the tree area into two panes in the given direction, both
+	showing the selection. Splitting the same way again joins them back
+	into the focused pane
+*/
+void split_view(enum split mode)
+{
+	int other = 1 - current_pane;
+	store_pane();
+	if (split == mode) {
+		/* the focused pane's folds become the tree's */
+		use_rows(&shared_rows);
+		merge_marks(&panes[current_pane].folds);
+		clear_marks(&panes[other].folds);
+		free_rows(&panes[0].rows);
+		free_rows(&panes[1].rows);
+		r_remove(&panes[other].view);
+		panes[0] = panes[current_pane];
+		restore_pane(0);
+		npanes = 1;
+		split = SPLIT_NONE;
+	} else {
+		if (split == SPLIT_NONE) {
+			panes[1] = panes[0];
+			memset(&panes[1].view, 0, sizeof(panes[1].view));
+			memset(&panes[1].folds, 0, sizeof(panes[1].folds));
+			memset(&panes[1].rows, 0, sizeof(panes[1].rows));
+			npanes = 2;
+		}
+		split = mode;
+	}
+	resize();
+}
+
+/******************************************************************************
+	Move the focus to pane i, wrapping around
+*/
+void focus_pane(int i)
+{
+	if (npanes < 2) {
+		say("No other panes.");
+		return;
+	}
+	store_pane();
+	restore_pane((i + npanes) % npanes);
+}
+
+/******************************************************************************
+	Point the unfocused panes at the focused pane's selection, after the
+	tree they were showing was replaced
+*/
+void reset_panes()
+{
+	int i;
+	/* the row indexes and folds belong to the old tree */
+	use_rows(&shared_rows);
+	view_root = NULL;
+	for (i = 0; i < npanes; i++) {
+		clear_marks(&panes[i].folds);
+		panes[i].rows.root = NULL;
+		if (i == current_pane)
+			continue;
+		panes[i].selected = selected_entry;
+		panes[i].vscroll = vscroll;
+	}
+}
+
+/******************************************************************************
+	Move the selection of any unfocused pane out of t's branch and drop
+	the folds the panes made inside it before t is deleted
+*/
+void unlink_panes(struct tree *t)
+{
+	struct tree *p;
+	int i;
+	if (t == NULL || t->parent == NULL)
+		return;
+	for (i = 0; i < npanes; i++) {
+		drop_marks(&panes[i].folds, t, false);
+		if (i == current_pane) {
+			use_rows(pane_rows(i));
+			continue;
+		}
+		for (p = panes[i].selected; p != NULL; p = p->parent) {
+			if (p == t) {
+				panes[i].selected = t->parent;
+				break;
 			}
-			tree->nchild--;
-			child->parent = NULL;
-			return child;
 		}
 	}
+}
+
+/******************************************************************************
+	Return t, or if a fold hides it, its outermost collapsed ancestor
+*/
+struct tree *visible_ancestor(struct tree *t)
+{
+	struct tree *p, *v = t;
+	int levels;
+	fold_settle(t);
+	if (panes[current_pane].folds.n > 0) {
+		p = t->parent != NULL ? collapsed_above(t->parent, &levels) : NULL;
+		return p != NULL ? p : t;
+	}
+	for (p = t->parent; p != NULL; p = p->parent) {
+		if (p->state == COLLAPSED)
+			v = p;
+	}
+	return v;
+}
+
+/******************************************************************************
+	Return the outermost of t and its ancestors that the focused pane
+	shows collapsed, or NULL, and set levels to what the pane's marks
+	leave for t's children. The states must be settled down to t
+*/
+struct tree *collapsed_above(struct tree *t, int *levels)
+{
+	struct tree *v = NULL;
+	*levels = FOLD_NONE;
+	if (t->parent != NULL)
+		v = collapsed_above(t->parent, levels);
+	if (mark_fold(t, levels) == COLLAPSED && v == NULL)
+		v = t;
+	return v;
+}
+
+/******************************************************************************
+	Return the state the focused pane shows for t
+*/
+enum fold_state fold_of(struct tree *t)
+{
+	int levels = FOLD_NONE;
+	fold_settle(t);
+	if (panes[current_pane].folds.n == 0)
+		return t->nchild == 0 ? EMPTY : t->state;
+	if (t->parent != NULL)
+		collapsed_above(t->parent, &levels);
+	return mark_fold(t, &levels);
+}
+
+/******************************************************************************
+	Return the state the focused pane shows for t, given the levels the
+	pane's marks above t leave for it, and hand them on to t's children.
+	t's own state must be settled
+*/
+enum fold_state mark_fold(struct tree *t, int *levels)
+{
+	struct fold_mark *m = find_mark(&panes[current_pane].folds, t);
+	enum fold_state f = t->state;
+
+	if (m != NULL) {
+		f = m->state;
+		if (m->unfold != FOLD_NONE)
+			*levels = m->unfold;
+	} else if (*levels != FOLD_NONE) {
+		f = *levels > 0 ? EXPANDED : COLLAPSED;
+	}
+	if (*levels != FOLD_NONE && *levels != FOLD_ALL && *levels > 0)
+		(*levels)--;
+	return t->nchild == 0 ? EMPTY : f;
+}
+
+/******************************************************************************
+	Return o's mark for t, or NULL
+*/
+struct fold_mark *find_mark(struct overlay *o, struct tree *t)
+{
+	unsigned long i;
+	if (o->n == 0)
+		return NULL;
+	for (i = mark_hash(t) & (o->nslots - 1); o->slot[i] >= 0;
+			i = (i + 1) & (o->nslots - 1)) {
+		if (o->mark[o->slot[i]].t == t)
+			return &o->mark[o->slot[i]];
+	}
 	return NULL;
 }
 
 /******************************************************************************
-	Release the memory used by a tree and its children
+	Hash a node's address for the mark tables
+*/
+unsigned long mark_hash(struct tree *t)
+{
+	return ((unsigned long)t >> 4) * 2654435761UL;
+}
+
+/******************************************************************************
+	Rebuild o's table of marks after marks were added or dropped
 */
-void free_tree(struct tree *t)
+void index_marks(struct overlay *o)
 {
+	unsigned long h;
 	int i;
-	for (i = 0; i < t->nchild; i++) {
-		free_tree(t->child[i]);
+	if (o->nslots < 2 * o->n) {
+		while (o->nslots < 2 * o->n)
+			o->nslots = o->nslots == 0 ? 16 : o->nslots * 2;
+		o->slot = realloc(o->slot, sizeof(*o->slot) * o->nslots);
+	}
+	for (i = 0; i < o->nslots; i++) {
+		o->slot[i] = -1;
+	}
+	for (i = 0; i < o->n; i++) {
+		for (h = mark_hash(o->mark[i].t) & (o->nslots - 1); o->slot[h] >= 0;
+				h = (h + 1) & (o->nslots - 1))
+			;
+		o->slot[h] = i;
 	}
-	free(t->text);
-	free(t);
 }
 
 /******************************************************************************
-	Print an error and quit
+	Fold t in the focused pane only: show it as state, and unless unfold
+	is FOLD_NONE show that many levels below it, replacing the pane's
+	marks inside t's branch
 */
-void die(const char *error)
+void set_mark(struct tree *t, enum fold_state state, int unfold)
 {
-	endwin();
-	fprintf(stderr, "=====================================\n");
-	fprintf(stderr, "                ERROR                \n");
-	fprintf(stderr, "-------------------------------------\n");
-	fprintf(stderr, "%s\n", error);
-	fprintf(stderr, "=====================================\n");
-	exit(1);
+	struct overlay *o = &panes[current_pane].folds;
+	struct fold_mark *m;
+	unsigned long i;
+
+	if (unfold != FOLD_NONE)
+		drop_marks(o, t, true);
+	if ((m = find_mark(o, t)) == NULL) {
+		if (o->n == o->alloc) {
+			o->alloc = o->alloc == 0 ? 16 : o->alloc * 2;
+			o->mark = realloc(o->mark, sizeof(*o->mark) * o->alloc);
+		}
+		m = &o->mark[o->n++];
+		m->t = t;
+		m->unfold = FOLD_NONE;
+		if (o->nslots < 2 * o->n) {
+			index_marks(o);
+		} else {
+			for (i = mark_hash(t) & (o->nslots - 1); o->slot[i] >= 0;
+					i = (i + 1) & (o->nslots - 1))
+				;
+			o->slot[i] = o->n - 1;
+		}
+	}
+	m->state = state;
+	if (unfold != FOLD_NONE)
+		m->unfold = unfold;
+	/* the pane may have just got folds of its own */
+	use_rows(pane_rows(current_pane));
+	reshaped(t, 0);
 }
 
 /******************************************************************************
-	Return the topmost node connected to leaf
+	Drop o's marks on t's descendants, and on t itself unless keep_t
 */
-struct tree *find_root(struct tree *leaf)
+void drop_marks(struct overlay *o, struct tree *t, bool keep_t)
 {
-	if (leaf->parent == NULL)
-		return leaf;
-	return find_root(leaf->parent);
+	struct tree *p;
+	int i, n = 0;
+	if (o->n == 0)
+		return;
+	for (i = 0; i < o->n; i++) {
+		p = o->mark[i].t;
+		if (keep_t && p == t)
+			p = NULL;
+		for (; p != NULL && p != t; p = p->parent)
+			;
+		/* marks outside t's branch are kept in order */
+		if (p == NULL)
+			o->mark[n++] = o->mark[i];
+	}
+	if (n != o->n) {
+		o->n = n;
+		index_marks(o);
+	}
 }
 
 /******************************************************************************
-	Set the window's position and size, reallocating if necessary
+	Drop all of o's marks
 */
-WINDOW *set_window(WINDOW *win, int h, int w, int y, int x)
+void clear_marks(struct overlay *o)
 {
-	int wy, wx, ww, wh;
-	if (win != NULL) {
-		getbegyx(win, wy, wx);
-		getmaxyx(win, wh, ww);
-		if (ww == w && wh == h && wx == x && wy == y)
-			return win;
-		if (ww == w && wh == h && (wx != x || wy != y)) {
-			mvwin(win, y, x);
-			return win;
-		}
-		delwin(win);		
-		win = NULL;
+	free(o->mark);
+	free(o->slot);
+	memset(o, 0, sizeof(*o));
+}
+
+/******************************************************************************
+	Make o's folds the tree's own and drop them. The marks are applied
+	oldest first, so a fold over a branch comes before those inside it
+*/
+void merge_marks(struct overlay *o)
+{
+	struct fold_mark *m;
+	int i;
+	for (i = 0; i < o->n; i++) {
+		m = &o->mark[i];
+		fold_settle(m->t);
+		if (m->unfold != FOLD_NONE)
+			fold_subtree(m->t, m->unfold);
+		if (m->t->nchild > 0)
+			m->t->state = m->state;
+		reshaped(m->t, 0);
 	}
-	return newwin(h, w, y, x);
+	clear_marks(o);
 }
 
 /******************************************************************************
-	Query terminal for size and update windows accordingly
+	Queue every pane for output
 */
-void resize()
+void refresh_panes()
 {
-	getmaxyx(stdscr, screenh, screenw);
-	status_win_height = STATUS_SIZE;
-	help_win_height = help_mode == H_HIDE ? 0 : HELP_SIZE;
-	tree_win_height = screenh
-		- (status_win_height + help_win_height + input_win_height);
-	/* keep a table of onscreen entries to map cursor row to struct ptr */
-	onscreen_entries = realloc(onscreen_entries,
-			sizeof(*onscreen_entries) * tree_win_height);
-	/* create new tree window of correct size */
-	tree_window = set_window(tree_window, tree_win_height, screenw, 0, 0);
-	/* create new status window of correct size */
-	status_window = set_window(status_window, status_win_height, screenw,
-			screenh - help_win_height - status_win_height, 0);
-	/* if visible, create new help window of correct size */
-	if (help_mode != H_HIDE) {
-		help_window = set_window(help_window,
-				help_win_height,
-				screenw,
-				screenh - help_win_height, 0);
-	} else {
-		if (help_window != NULL) {
-			delwin(help_window);
-			help_window = NULL;
-		}
+	int i;
+	for (i = 0; i < npanes; i++) {
+		if (i != current_pane)
+			r_refresh(&panes[i].view);
 	}
+	r_refresh(&tree_view);
 }
 
 /******************************************************************************
@@ -307,9 +684,25 @@ void init_curses()
 	noecho();
 	raw();
 	curs_set(0);
+	define_key("\033[200~", KEY_PASTE);
+	define_key("\033[201~", KEY_PASTE_END);
+	paste_mode(true);
 	resize();
 }
 
+/******************************************************************************
+	Ask the terminal to mark the start and end of pasted text, so that a
+	paste isn't taken as commands, or stop before leaving curses
+*/
+void paste_mode(bool on)
+{
+	if (on == paste_on)
+		return;
+	paste_on = on;
+	fputs(on ? "\033[?2004h" : "\033[?2004l", stdout);
+	fflush(stdout);
+}
+
 /******************************************************************************
 	Move the selected entry up
 */
@@ -333,7 +726,9 @@ void shove_up()
 			struct tree *swap = parent->child[b];
 			parent->child[b] = sel;
 			parent->child[a] = swap;
-			modified = true;
+			hash_dirty(parent);
+			reshaped(parent, a < b ? a : b);
+			changed();
 		}
 	}
 }
@@ -361,7 +756,9 @@ void shove_down()
 			struct tree *swap = parent->child[b];
 			parent->child[b] = sel;
 			parent->child[a] = swap;
-			modified = true;
+			hash_dirty(parent);
+			reshaped(parent, a < b ? a : b);
+			changed();
 		}
 	}
 }
@@ -393,7 +790,7 @@ void promote()
 			for (i = 0; i < shoves; i++) {
 				shove_up(); 
 			}
-			modified = true;
+			changed();
 		} else {
 			die("Lost child while promoting");
 		}
@@ -429,7 +826,7 @@ void demote()
 			for (i = 0; i < new_parent->nchild-1; i++) {
 				shove_up();
 			}
-			modified = true;
+			changed();
 		}
 	}
 }
@@ -439,13 +836,19 @@ void demote()
 */
 void select_up()
 {
-	if (selected_entry == NULL || selected_index <= 0) {
-		selected_entry = onscreen_entries[0];
-		if (vscroll > 0)
-			vscroll--;
-	}
-	else 
-		selected_entry = onscreen_entries[selected_index-1];
+	long row = -1;
+	if (selected_entry != NULL)
+		row = row_of(visible_ancestor(selected_entry));
+	if (row < 0)
+		row = vscroll;
+	else if (row > 0)
+		row--;
+	extend_rows(row + 1);
+	if (row >= view_nrows)
+		return;
+	selected_entry = view_rows[row];
+	if (row < vscroll)
+		vscroll = row;
 }
 
 /******************************************************************************
@@ -453,13 +856,21 @@ void select_up()
 */
 void select_down()
 {
-	if (selected_entry == NULL || selected_index >= printed_lines-vscroll-1) {
-		selected_entry = onscreen_entries[printed_lines-vscroll-1];
-		if (vscroll+tree_win_height <= printed_lines)
-			vscroll++;
-	}
+	long row = -1;
+	if (selected_entry != NULL)
+		row = row_of(visible_ancestor(selected_entry));
+	if (row < 0)
+		row = vscroll;
 	else
-		selected_entry = onscreen_entries[selected_index+1];
+		row++;
+	extend_rows(row + 1);
+	if (row >= view_nrows)
+		row = view_nrows - 1;
+	if (row < 0)
+		return;
+	selected_entry = view_rows[row];
+	if (row >= vscroll + tree_win_height)
+		vscroll = row - tree_win_height + 1;
 }
 
 /******************************************************************************
@@ -467,52 +878,131 @@ void select_down()
 */
 void set_fold(enum fold_state f)
 {
-	if (selected_entry != NULL) {
-		selected_entry->state = f;
+	if (selected_entry == NULL)
+		return;
+	/* a split pane keeps its folds to itself */
+	if (npanes > 1) {
+		set_mark(selected_entry, f, FOLD_NONE);
+		return;
+	}
+	fold_settle(selected_entry);
+	selected_entry->state = f;
+	reshaped(selected_entry, 0);
+}
+
+/******************************************************************************
+	Expand the selected entry so that levels levels below it show, or
+	collapse its whole branch with 0
+*/
+void fold_branch(int levels)
+{
+	if (selected_entry == NULL)
+		return;
+	if (npanes > 1) {
+		set_mark(selected_entry, levels > 0 ? EXPANDED : COLLAPSED, levels);
+	} else {
+		fold_settle(selected_entry);
+		fold_subtree(selected_entry, levels);
 	}
+	reveal(selected_entry);
+}
 
+/******************************************************************************
+	Collapse every branch that doesn't lead to the selected entry
+*/
+void focus()
+{
+	struct tree *t, *p;
+	int i;
+	if (selected_entry == NULL)
+		return;
+	fold_settle(selected_entry);
+	for (t = selected_entry; t->parent != NULL; t = p) {
+		p = t->parent;
+		for (i = 0; i < p->nchild; i++) {
+			if (p->child[i] == t)
+				continue;
+			if (npanes > 1)
+				set_mark(p->child[i], COLLAPSED, 0);
+			else
+				fold_subtree(p->child[i], 0);
+		}
+	}
+	reveal(selected_entry);
 }
 
 /******************************************************************************
 	Prompt the user to input a string
 */
 char *prompt(const char *msgstr, const char *defstr)
+{
+	return prompt_complete(msgstr, defstr, NULL);
+}
+
+/******************************************************************************
+	Prompt the user to input a string, completing it with complete when
+	Tab is pressed
+*/
+char *prompt_complete(const char *msgstr, const char *defstr,
+		rl_completer complete)
 {
 	WINDOW *prompt_win;
 	WINDOW *input_win;
 	char *str;
 	int len;
-	int c;
+	int c = 0;
 	struct rlstate *rl;
 
+	if (prompt_source != NULL) {
+		str = prompt_source(msgstr, defstr);
+		if (str != NULL && str[0] != '\0')
+			return str;
+		free(str);
+		say("Input cancelled.");
+		return NULL;
+	}
+
 	help_mode = help_mode == H_NORMAL ? H_EDIT : H_HIDE;
 	input_win_height = 2;
 	resize();
 	redraw();
 
-	prompt_win = newwin(1, screenw, tree_win_height, 0);
+	prompt_win = newwin(1, screenw, tree_area_height, 0);
 	wbkgdset(prompt_win, A_BOLD | A_UNDERLINE);
 	whline(prompt_win, ' ', screenw);
 	waddstr(prompt_win, msgstr);
 	wrefresh(prompt_win);
 
-	input_win = newwin(1, screenw, tree_win_height + 1, 0);
+	input_win = newwin(1, screenw, tree_area_height + 1, 0);
 	wmove(input_win, 0, 0);
 	wrefresh(input_win);
 
 	rl = rl_start(input_win);
+	rl_setcomplete(rl, complete);
 	if (defstr != NULL)
 		rl_set(rl, defstr);
 	do  {
-		if (c == 0x1F) { /* C-? */
-			help_mode = help_mode == H_HIDE ? H_EDIT : H_HIDE;
+		if (c == 0x1F || c == KEY_RESIZE) {
+			if (c == KEY_RESIZE) {
+				settle_resize(input_win);
+			} else { /* C-? */
+				help_mode = help_mode == H_HIDE ? H_EDIT : H_HIDE;
+			}
 			resize();
-			mvwin(input_win, tree_win_height + 1, 0);
-			mvwin(prompt_win, tree_win_height, 0);
+			input_win = set_window(input_win, 1, screenw,
+					tree_area_height + 1, 0);
+			prompt_win = set_window(prompt_win, 1, screenw,
+					tree_area_height, 0);
+			rl_setwin(rl, input_win);
+			wbkgdset(prompt_win, A_BOLD | A_UNDERLINE);
+			wmove(prompt_win, 0, 0);
+			whline(prompt_win, ' ', screenw);
+			waddstr(prompt_win, msgstr);
 			redraw();
-			wnoutrefresh(tree_window);
-			wnoutrefresh(status_window);
-			wnoutrefresh(help_window);
+			refresh_panes();
+			r_refresh(&status_view);
+			r_refresh(&stats_view);
+			r_refresh(&help_view);
 			wnoutrefresh(prompt_win);
 		}
 		rl_draw(rl);
@@ -538,46 +1028,238 @@ char *prompt(const char *msgstr, const char *defstr)
 }
 
 /******************************************************************************
-	Create a new entry, prompt for its contents, add it to tree
+	Complete the text of an entry from the others in the tree
 */
-void insert_entry()
+long complete_entry(const char *prefix, int len, char ***matches)
+{
+	return root != NULL ? match_entries(root, prefix, len, matches) : 0;
+}
+
+/******************************************************************************
+	Complete the last word of a tag query from the tags in the tree
+*/
+long complete_tags(const char *prefix, int len, char ***matches)
+{
+	return root != NULL ? match_tags(root, prefix, len, matches) : 0;
+}
+
+/******************************************************************************
+	Ask for tags and attributes to find, then select the first entry
+	after the selection that has all of them
+*/
+void find_tags()
 {
-	char *str = prompt("New entry", NULL);
+	char *str = prompt_complete("Find tags...", NULL, complete_tags);
 	if (str == NULL)
 		return;
-	if (strlen(str) > 0) {
-		if (selected_entry == NULL)
-			selected_entry = root;
-		selected_entry = add_child(selected_entry, str);
-		modified = true;
-	} else {
-		say("Entry cancelled.");
-	}
+	strcpy(find_query, str);
 	free(str);
+	find_next(1);
 }
 
 /******************************************************************************
-	Edit an existing entry
+	Select the next entry matching the last tag query, or with dir
+	negative the one before, going round at either end
 */
-void edit_entry()
+void find_next(int dir)
 {
-	char *str;
-	
-	if (selected_entry == NULL) {
+	char msg[MAX_SAY_CHARS];
+	struct tag_found found;
+	long n, pos, lo, hi, mid;
+
+	if (root == NULL)
 		return;
-	} else if (selected_entry == root) {
-		say("Cannot modify root entry.");
+	if (find_query[0] == '\0') {
+		say("Press / to find tags.");
 		return;
 	}
-
- 	str = prompt("Edit entry", selected_entry->text);
-	if (str == NULL)
+	if ((n = tag_query(root, find_query, &found)) < 0) {
+		say("Type #tag or @key=value.");
 		return;
-	if (strlen(str) > 0) {
-		free(selected_entry->text);
-		selected_entry->text = str;
+	} else if (n == 0) {
+		say("No entries match.");
+		return;
+	}
+	/* the first match after the selection */
+	pos = selected_entry != NULL ? preorder(selected_entry) : 0;
+	lo = 0;
+	hi = n;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (found.pre[mid] <= pos)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (dir < 0) {
+		lo--;
+		if (lo >= 0 && found.pre[lo] == pos)
+			lo--;
+		if (lo < 0)
+			lo = n - 1;
+	} else if (lo == n) {
+		lo = 0;
+	}
+	reveal(found.node[lo]);
+	snprintf(msg, sizeof(msg), "Match %ld of %ld.", lo + 1, n);
+	say(msg);
+}
+
+/******************************************************************************
+	Read pasted text from win up to the end of the paste, with line breaks
+	as '\n'. Returns it malloc'd and sets len to its length
+*/
+char *read_paste(WINDOW *win, size_t *len)
+{
+	size_t alloc = 4096;
+	char *text = malloc(alloc);
+	int c, prev = 0;
+
+	*len = 0;
+	/* stop waiting if the end of the paste never comes */
+	wtimeout(win, PASTE_TIMEOUT);
+	while ((c = wgetch(win)) != KEY_PASTE_END && c != ERR) {
+		/* terminals send a line break as '\r', and some as "\r\n" */
+		if (c == '\n' && prev == '\r')
+			continue;
+		prev = c;
+		if (c == '\r')
+			c = '\n';
+		if (c > 0xFF)
+			continue;
+		if (*len == alloc) {
+			alloc *= 2;
+			text = realloc(text, alloc);
+		}
+		text[(*len)++] = c;
+	}
+	wtimeout(win, -1);
+	return text;
+}
+
+/******************************************************************************
+	Add pasted lines under the selected entry as one change, indented
+	lines becoming children as they would in a file. The indent the
+	lines share is taken off first, and blank lines are dropped
+*/
+void paste_entries()
+{
+	char msg[MAX_SAY_CHARS];
+	struct tree *t, *sel, *first, **kids;
+	struct reader rd;
+	size_t len, i, j, start;
+	long strip = -1, indent, n, pasted;
+	enum errcode err;
+	char *text;
+	FILE *f;
+
+	text = read_paste(tree_view.win, &len);
+	/* find the shallowest indent of a line with text */
+	for (i = 0; i < len; i = j + 1) {
+		for (j = i; j < len && (text[j] == '\t' || text[j] == ' '); j++)
+			;
+		indent = j - i;
+		for (; j < len && text[j] != '\n'; j++)
+			;
+		if (j > i + indent && (strip < 0 || indent < strip))
+			strip = indent;
+	}
+	/* take it off each line, in place */
+	for (i = start = 0; i < len; i = j + 1) {
+		for (j = i; j < len && text[j] != '\n'; j++)
+			;
+		if (j - i <= (size_t)strip)
+			continue;
+		memmove(&text[start], &text[i + strip], j - i - strip);
+		start += j - i - strip;
+		text[start++] = '\n';
+	}
+	if (start == 0 || (f = fmemopen(text, start, "r")) == NULL) {
+		free(text);
+		say("Nothing pasted.");
+		return;
+	}
+
+	/* mis-indented lines go under the nearest entry that fits */
+	t = add_child(NULL, "Entries");
+	reader_init(&rd, f);
+	rd.recover = true;
+	err = read_forest(&rd, t);
+	fclose(f);
+	free(text);
+	if (err != ERR_NONE || t->nchild == 0) {
+		snprintf(msg, sizeof(msg), "Line %ld:%d: %s",
+				rd.line, rd.column, rd.msg);
+		say(err != ERR_NONE ? msg : "Nothing pasted.");
+		free_tree(t);
+		reader_free(&rd);
+		return;
+	}
+
+	/* graft everything read on in one go */
+	pasted = t->ndesc;
+	sel = selected_entry != NULL ? selected_entry : root;
+	kids = malloc(sizeof(*kids) * (sel->nchild + t->nchild));
+	memcpy(kids, sel->child, sizeof(*kids) * sel->nchild);
+	memcpy(&kids[sel->nchild], t->child, sizeof(*kids) * t->nchild);
+	n = sel->nchild + t->nchild;
+	first = t->child[0];
+	set_children(t, NULL, 0);
+	set_children(sel, kids, n);
+	free(kids);
+	free_tree(t);
+	changed();
+	reveal(first);
+
+	if (rd.nproblems > 0)
+		snprintf(msg, sizeof(msg), "Pasted, fixed %d lines.", rd.nproblems);
+	else
+		snprintf(msg, sizeof(msg), "Pasted %ld entries.", pasted);
+	reader_free(&rd);
+	say(msg);
+}
+
+/******************************************************************************
+	Create a new entry, prompt for its contents, add it to tree
+*/
+void insert_entry()
+{
+	char *str = prompt_complete("New entry", NULL, complete_entry);
+	if (str == NULL)
+		return;
+	if (strlen(str) > 0) {
+		if (selected_entry == NULL)
+			selected_entry = root;
+		selected_entry = add_child(selected_entry, str);
+		changed();
+	} else {
+		say("Entry cancelled.");
+	}
+	free(str);
+}
+
+/******************************************************************************
+	Edit an existing entry
+*/
+void edit_entry()
+{
+	char *str;
+	
+	if (selected_entry == NULL) {
+		return;
+	} else if (selected_entry == root) {
+		say("Cannot modify root entry.");
+		return;
+	}
+
+ 	str = prompt_complete("Edit entry", selected_entry->text,
+			complete_entry);
+	if (str == NULL)
+		return;
+	if (strlen(str) > 0) {
+		tag_set_text(selected_entry, str);
 		say("Editing complete.");
-		modified = true;
+		changed();
 	} else {
 		free(str);
 		say("Edit cancelled.");
@@ -586,299 +1268,1100 @@ void edit_entry()
 
 
 /******************************************************************************
-	Recursively traverse the tree and print its contents.
-	Also updates the values of onscreen_entries to simplify
-	selection and cursor movement
+	Draw the focused pane's rows from the row index, marking the
+	selection with highlight. Also updates the values of onscreen_entries
+	to simplify selection and cursor movement
 */
-void print_tree(struct tree *tree, int depth)
+void print_tree(int highlight)
 {
-	int i = 0;
-	int col = 0;
-	if (tree == NULL)
-		return;
-	if (tree == root) {
-		printed_lines = 0;
-		wmove(tree_window, 0, 0);
-	}
-	if (printed_lines - vscroll >= tree_win_height)
-		return;
-	if (tree_window == NULL)
+	struct tree *tree;
+	int i, col, width, depth;
+	enum fold_state state;
+	bool ellipsis;
+	long row;
+	char label[16];
+
+	if (!tree_view.open)
 		return;
-	if (tree->nchild == 0)
-		tree->state = EMPTY;
-
-	/* only actually print if its onscreen */
-	if (printed_lines - vscroll >= 0
-			&& printed_lines - vscroll < tree_win_height) {
-		/* indent */
-		for (i = 0; i < depth; i++) {
-			wprintw(tree_window, "  ");
+	stats.visited += extend_rows(vscroll + tree_win_height);
+	/* a fold made in another pane may have hidden the selection */
+	if (selected_entry != NULL)
+		selected_entry = visible_ancestor(selected_entry);
+	printed_lines = view_nrows < vscroll + tree_win_height
+		? view_nrows : vscroll + tree_win_height;
+
+	r_move(&tree_view, 0, 0);
+	for (i = 0; i < tree_win_height; i++) {
+		row = vscroll + i;
+		/* clear any empty lines below the last entry */
+		if (row < 0 || row >= view_nrows) {
+			onscreen_entries[i] = NULL;
+			r_clrtoeol(&tree_view);
+			r_addstr(&tree_view, "\n");
+			continue;
+		}
+		tree = view_rows[row];
+		depth = view_depth[row];
+		stats.visited++;
+
+		/* indent, no further than leaves room for the box */
+		if (depth * 2 + 4 > tree_win_width)
+			depth = tree_win_width > 4 ? (tree_win_width - 4) / 2 : 0;
+		for (col = 0; col < depth; col++) {
+			r_addstr(&tree_view, "  ");
 		}
 	
-		switch(tree->state) {
-			case EMPTY:     wprintw(tree_window, "[ ] "); break;
-			case EXPANDED:  wprintw(tree_window, "[-] "); break;
-			case COLLAPSED: wprintw(tree_window, "[+] "); break;
+		state = panes[current_pane].folds.n > 0 ? fold_of(tree)
+			: tree->state;
+		switch(state) {
+			case EMPTY:     r_addstr(&tree_view, "[ ] "); break;
+			case EXPANDED:  r_addstr(&tree_view, "[-] "); break;
+			case COLLAPSED: r_addstr(&tree_view, "[+] "); break;
 		}
 
 		/*    indent     [ ] */
 		col = depth * 2 + 4;
 
+		/* collapsed entries show how many entries they hide, from the
+		   count cached in the node */
+		label[0] = '\0';
+		if (state == COLLAPSED) {
+			label[0] = ' ';
+			count_label(tree->ndesc, label + 1, sizeof(label) - 1);
+		}
+		width = tree_win_width - 3 - col - strlen(label);
+		/* a negative width would write the whole text and wrap, so
+		   deep entries lose the label, then the "...", then the text */
+		if (width < 0) {
+			label[0] = '\0';
+			width = tree_win_width - 3 - col;
+		}
+		ellipsis = width >= 0;
+		if (width < 0)
+			width = 0;
+
 		/* highlight selection */
 		if (selected_entry == tree)
-			wattron(tree_window, A_STANDOUT);
-		waddnstr(tree_window, tree->text, screenw - 3 - col);
-		if (strlen(tree->text) > screenw - 3 - col) 
-			waddstr(tree_window, "...");
-		waddch(tree_window, '\n');
+			r_attron(&tree_view, highlight);
+		r_addnstr(&tree_view, tree->text, width);
+		if (ellipsis && strlen(tree->text) > (size_t)width)
+			r_addstr(&tree_view, "...");
 		if (selected_entry == tree)
-			wattroff(tree_window, A_STANDOUT);
+			r_attroff(&tree_view, highlight);
+		if (label[0] != '\0') {
+			r_attron(&tree_view, A_DIM);
+			r_addstr(&tree_view, label);
+			r_attroff(&tree_view, A_DIM);
+		}
+		r_addch(&tree_view, '\n');
 
-		onscreen_entries[printed_lines - vscroll] = tree;
+		onscreen_entries[i] = tree;
+		if (tree == selected_entry)
+			selected_index = i;
 	}
-	printed_lines++;
+}
 
-	/* print child recursively */
-	if (tree->state == EXPANDED) {
-		for (i = 0; i  < tree->nchild; i++) {
-			if (tree->child[i] != NULL)
-				print_tree(tree->child[i], depth+1);
+/******************************************************************************
+	Fill in the row index until it has upto rows or the tree runs out,
+	first dropping the rows that changes to the tree or its folds since
+	it was built may have moved. Returns the number of rows added
+*/
+long extend_rows(long upto)
+{
+	struct row_frame *f;
+	long start, cut, row;
+	bool touched = false;
+	unsigned long i;
+
+	if (view_root != root || tree_edits - view_edits > RESHAPE_LOG) {
+		/* the changes since are no longer all in the log */
+		view_root = root;
+		cut_rows(0);
+	} else if (tree_edits != view_edits) {
+		/* each change is found in the rows as they were, and none of
+		   them moved anything above the first */
+		cut = view_nrows;
+		for (i = view_edits; i != tree_edits; i++) {
+			row = changed_row(reshapes[i % RESHAPE_LOG].parent,
+					reshapes[i % RESHAPE_LOG].index);
+			if (row < 0)
+				continue;
+			touched = true;
+			if (row < cut)
+				cut = row;
 		}
+		if (touched)
+			cut_rows(cut);
 	}
+	view_edits = tree_edits;
+
+	start = view_nrows;
+	while (view_nrows < upto && view_nstack > 0) {
+		f = &view_stack[view_nstack - 1];
+		if (f->next < f->t->nchild)
+			push_row(f->t->child[f->next++]);
+		else
+			view_nstack--;
+	}
+	return view_nrows - start;
+}
 
-	/* stuff to run after the original call has finished */
-	if (tree == root) {
-		/* find the onscreen index of selected entry */
-		for (i = 0; i < printed_lines - vscroll; i++) {
-			if (onscreen_entries[i] == selected_entry) {
-				selected_index = i;
-				break;
+/******************************************************************************
+	Return the first row that a change to p's children or fold from child
+	i on may have moved, going by the rows before the change, or -1 if p
+	isn't among them and so nothing built shows the change
+*/
+long changed_row(struct tree *p, int i)
+{
+	long row, r;
+	int depth, n = 0;
+
+	if ((row = find_row(p, vscroll)) < 0)
+		return -1;
+	/* child i's row, or the end of p's rows if it had none */
+	depth = view_depth[row];
+	for (r = row + 1; r < view_nrows && view_depth[r] > depth; r++) {
+		if (view_depth[r] == depth + 1 && n++ == i)
+			break;
+	}
+	return r;
+}
+
+/******************************************************************************
+	Keep only the first n rows of the index, and rebuild the stack of
+	expanded entries being walked so that filling in continues after them
+*/
+void cut_rows(long n)
+{
+	struct tree *t;
+	int depth, i, levels;
+
+	view_nrows = n;
+	view_nstack = 0;
+	if (n == 0) {
+		if (root != NULL)
+			push_row(root);
+		return;
+	}
+	t = view_rows[n - 1];
+	depth = view_depth[n - 1];
+	while (view_stack_alloc < depth + 1) {
+		view_stack_alloc = view_stack_alloc == 0 ? 16
+			: view_stack_alloc * 2;
+		view_stack = realloc(view_stack,
+				sizeof(*view_stack) * view_stack_alloc);
+	}
+	/* each ancestor continues after the child on the way to t */
+	for (view_nstack = depth; depth > 0; t = t->parent) {
+		depth--;
+		for (i = 0; t->parent->child[i] != t; i++)
+			;
+		view_stack[depth].t = t->parent;
+		view_stack[depth].next = i + 1;
+		view_stack[depth].unfold = FOLD_NONE;
+	}
+	/* and hands on what the pane's marks leave for its children */
+	if (panes[current_pane].folds.n > 0) {
+		levels = FOLD_NONE;
+		for (i = 0; i < view_nstack; i++) {
+			mark_fold(view_stack[i].t, &levels);
+			view_stack[i].unfold = levels;
+		}
+	}
+	push_children(view_rows[n - 1]);
+}
+
+/******************************************************************************
+	Return the row of t, which must not be hidden by a fold, filling in
+	the row index as far as needed, or -1 if it isn't in the tree
+*/
+long row_of(struct tree *t)
+{
+	long row = vscroll + selected_index;
+
+	/* the selection is usually where it was last drawn */
+	extend_rows(0);
+	if (row >= 0 && row < view_nrows && view_rows[row] == t)
+		return row;
+	if ((row = find_row(t, vscroll)) >= 0)
+		return row;
+	for (row = view_nrows; ; row++) {
+		if (row == view_nrows && extend_rows(2 * view_nrows + 64) == 0)
+			return -1;
+		if (view_rows[row] == t)
+			return row;
+	}
+}
+
+/******************************************************************************
+	Return the row of t among those built so far, or -1. The search
+	starts at row from, since changes are mostly near what's onscreen
+*/
+long find_row(struct tree *t, long from)
+{
+	long row;
+	if (from > view_nrows)
+		from = view_nrows;
+	for (row = from; row < view_nrows; row++) {
+		if (view_rows[row] == t)
+			return row;
+	}
+	for (row = 0; row < from; row++) {
+		if (view_rows[row] == t)
+			return row;
+	}
+	return -1;
+}
+
+/******************************************************************************
+	Append t to the row index, and if it's expanded queue its children
+*/
+void push_row(struct tree *t)
+{
+	if (view_nrows == view_alloc) {
+		view_alloc = view_alloc == 0 ? 64 : view_alloc * 2;
+		view_rows = realloc(view_rows, sizeof(*view_rows) * view_alloc);
+		view_depth = realloc(view_depth,
+				sizeof(*view_depth) * view_alloc);
+	}
+	view_rows[view_nrows] = t;
+	view_depth[view_nrows++] = view_nstack;
+	push_children(t);
+}
+
+/******************************************************************************
+	Queue the children of t, the last row in the index, if it's expanded
+*/
+void push_children(struct tree *t)
+{
+	int levels = FOLD_NONE;
+	if (t->nchild == 0)
+		t->state = EMPTY;
+	if (panes[current_pane].folds.n > 0) {
+		/* the pane's own folds, going on from the frame t is in */
+		if (view_nstack > 0)
+			levels = view_stack[view_nstack - 1].unfold;
+		if (mark_fold(t, &levels) != EXPANDED)
+			return;
+	} else if (t->state != EXPANDED) {
+		return;
+	}
+	fold_push(t);
+	if (view_nstack == view_stack_alloc) {
+		view_stack_alloc = view_stack_alloc == 0 ? 16
+			: view_stack_alloc * 2;
+		view_stack = realloc(view_stack,
+				sizeof(*view_stack) * view_stack_alloc);
+	}
+	view_stack[view_nstack].t = t;
+	view_stack[view_nstack].unfold = levels;
+	view_stack[view_nstack++].next = 0;
+}
+
+/******************************************************************************
+	Restore the folds of t and its descendants from the markers
+	write_folds left in rd->folds, for a tree read by import_tree
+*/
+void read_folds(struct tree *t, struct reader *rd)
+{
+	int i;
+	t->state = getc(rd->folds) == '-' ? EXPANDED : COLLAPSED;
+	if (rd->count == rd->select)
+		rd->selected = t;
+	rd->count++;
+	for (i = 0; i < t->nchild; i++) {
+		read_folds(t->child[i], rd);
+	}
+}
+
+/******************************************************************************
+	Write one fold marker per node in preorder as the focused pane shows
+	it, given the levels its marks above t leave for t, remembering the
+	preorder index of the selected entry
+*/
+void write_folds(struct tree *t, int levels, FILE *f)
+{
+	enum fold_state state = t->state;
+	int i;
+	if (t == selected_entry)
+		state_select = state_count;
+	state_count++;
+	if (panes[current_pane].folds.n > 0)
+		state = mark_fold(t, &levels);
+	fputc(state == EXPANDED ? '-' : '+', f);
+	fold_push(t);
+	for (i = 0; i < t->nchild; i++) {
+		write_folds(t->child[i], levels, f);
+	}
+}
+
+/******************************************************************************
+	Save the current tree to the specified file
+*/
+void saveas(const char *fname)
+{
+	FILE *f;
+	double start;
+
+	if (fname == NULL || strlen(fname) == 0) {
+		say("No filename given.");
+		return;
+	}
+
+	if (strcmp(fname, filename) != 0) {
+		/* Warn if overwriting */
+		f = fopen(fname, "r");
+		if (f) {
+			fclose(f);
+			if (!confirm("File exists, overwrite? (y/n)")) {
+				say("Save cancelled.");
+				return;
 			}
 		}
-		/* clear any empty lines below the last entry */
-		for (i = printed_lines - vscroll; i < tree_win_height; i++) {
-			onscreen_entries[i] = NULL;
-			wclrtoeol(tree_window);
-			wprintw(tree_window, "\n");
+	} else {
+		/* warn if another program wrote the file since it was read */
+		struct file_stamp now;
+		stamp_file(fname, &now);
+		if (now.exists && disk_stamp.exists
+				&& !same_stamp(&now, &disk_stamp)
+				&& !confirm("File changed on disk, overwrite? (y/n)")) {
+			say("Save cancelled.");
+			return;
+		}
+	}
+	start = stats_clock();
+	f = fopen(fname, "w");
+
+	if (!f) {
+		say("Error opening file.");
+		return;
+	}
+	
+	export_tree(root, f, format_of(fname));
+	fclose(f);
+
+	drop_recovery();
+	/* save() passes filename itself */
+	if (fname != filename)
+		strcpy(filename, fname);
+	saved_hash = recover_hash = tree_hash(root);
+	repaired = false;
+	save_state(fname);
+	stamp_file(fname, &disk_stamp);
+	seen_stamp = disk_stamp;
+	watch_file(fname);
+	stats.save = stats_clock() - start;
+
+	say("Saved.");
+}
+
+/******************************************************************************
+	Build the name of the state file kept next to fname
+*/
+void state_name(const char *fname, char *buf)
+{
+	const char *base = strrchr(fname, '/');
+	int dirlen;
+
+	base = base == NULL ? fname : base + 1;
+	dirlen = base - fname;
+	memcpy(buf, fname, dirlen);
+	buf[dirlen] = '.';
+	strcpy(&buf[dirlen+1], base);
+	strcat(buf, STATE_SUFFIX);
+}
+
+/******************************************************************************
+	Name of the hidden recovery file for fname, next to it like the state
+	file. A tree with no file gets one in the current directory, named
+	after the process so that editors started there don't share one
+*/
+void recover_name(const char *fname, char *buf)
+{
+	char untitled[sizeof(RECOVER_UNTITLED) + 24];
+	if (strlen(fname) == 0) {
+		sprintf(untitled, "%s-%ld", RECOVER_UNTITLED, (long)getpid());
+		fname = untitled;
+	}
+	state_name(fname, buf);
+	strcpy(buf + strlen(buf) - strlen(STATE_SUFFIX), RECOVER_SUFFIX);
+}
+
+/******************************************************************************
+	Find a recovery file for a tree with no file in the current directory
+	whose editor is no longer running, and copy its name to buf. Returns
+	false if there is none
+*/
+bool orphan_recovery(char *buf)
+{
+	const char *prefix = "." RECOVER_UNTITLED "-";
+	struct dirent *e;
+	char *end;
+	long pid;
+	bool found = false;
+	DIR *d;
+
+	if ((d = opendir(".")) == NULL)
+		return false;
+	while (!found && (e = readdir(d)) != NULL) {
+		if (strncmp(e->d_name, prefix, strlen(prefix)) != 0)
+			continue;
+		pid = strtol(e->d_name + strlen(prefix), &end, 10);
+		if (pid <= 0 || strcmp(end, RECOVER_SUFFIX) != 0)
+			continue;
+		if (kill((pid_t)pid, 0) == 0 || errno != ESRCH)
+			continue;
+		strcpy(buf, e->d_name);
+		found = true;
+	}
+	closedir(d);
+	return found;
+}
+
+/******************************************************************************
+	Write the tree to fname in the format its extension names, leaving
+	the current file as it is
+*/
+void export_file(const char *fname)
+{
+	char msg[MAX_SAY_CHARS];
+	enum export_format fmt;
+	FILE *f;
+
+	if (fname == NULL || strlen(fname) == 0) {
+		say("No filename given.");
+		return;
+	}
+	f = fopen(fname, "r");
+	if (f) {
+		fclose(f);
+		if (!confirm("File exists, overwrite? (y/n)")) {
+			say("Export cancelled.");
+			return;
+		}
+	}
+	f = fopen(fname, "w");
+	if (!f) {
+		say("Error opening file.");
+		return;
+	}
+	fmt = format_of(fname);
+	export_tree(root, f, fmt);
+	if (fclose(f) != 0) {
+		say("Error writing file.");
+		return;
+	}
+	snprintf(msg, sizeof(msg), "Exported %ld entries as %s",
+			root->ndesc, exporters[fmt].desc);
+	say(msg);
+}
+
+/******************************************************************************
+	Remember the folds, selection and scroll position for fname. The
+	header records the size and mtime of fname so that a stale state
+	file is ignored if something else rewrites the tree.
+*/
+void save_state(const char *fname)
+{
+	char sname[MAX_ENTRY_LEN + sizeof(STATE_SUFFIX) + 1];
+	struct stat st;
+	FILE *f;
+	int i, levels;
+
+	if (root == NULL || stat(fname, &st) != 0)
+		return;
+	state_name(fname, sname);
+	f = fopen(sname, "w");
+	if (f == NULL)
+		return;
+	/* the selection index isn't known until the folds are written, so
+	   leave room for the header and fill it in afterwards */
+	fprintf(f, "%80s\n", "");
+	state_count = 0;
+	state_select = -1;
+	/* a fold of the whole tree may still be pending on the root */
+	fold_push(root);
+	levels = FOLD_NONE;
+	if (panes[current_pane].folds.n > 0)
+		mark_fold(root, &levels);
+	for (i = 0; i < root->nchild; i++) {
+		write_folds(root->child[i], levels, f);
+	}
+	fputc('\n', f);
+	rewind(f);
+	fprintf(f, "%ld %ld %d %ld", (long)st.st_size, (long)st.st_mtime,
+			vscroll, state_select);
+	fclose(f);
+}
+
+/******************************************************************************
+	Open the state file for fname and read its header into rd and scroll,
+	returning NULL if there isn't one or it doesn't match the file on disk
+*/
+FILE *open_state(const char *fname, struct reader *rd, int *scroll)
+{
+	char sname[MAX_ENTRY_LEN + sizeof(STATE_SUFFIX) + 1];
+	char header[82];
+	struct stat st;
+	long size, mtime, select;
+	int saved;
+	FILE *f;
+
+	if (stat(fname, &st) != 0)
+		return NULL;
+	state_name(fname, sname);
+	f = fopen(sname, "r");
+	if (f == NULL)
+		return NULL;
+	if (fgets(header, sizeof(header), f) == NULL
+			|| sscanf(header, "%ld %ld %d %ld",
+				&size, &mtime, &saved, &select) != 4
+			|| size != (long)st.st_size
+			|| mtime != (long)st.st_mtime) {
+		fclose(f);
+		return NULL;
+	}
+	*scroll = saved < 0 ? 0 : saved;
+	rd->select = select;
+	return f;
+}
+
+/******************************************************************************
+	If a working file exists, save to it. Otherwise prompt for a filename
+*/
+void save()
+{
+	struct file_stamp now;
+	if (strlen(filename) == 0) {
+		saveas(prompt_complete("Save as...", NULL, match_files));
+		return;
+	}
+	/* skip rewriting a file that already holds the tree */
+	stamp_file(filename, &now);
+	if (!is_modified() && same_stamp(&now, &disk_stamp)) {
+		save_state(filename);
+		say("No changes to save.");
+		return;
+	}
+	saveas(filename);
+}
+
+/******************************************************************************
+	Discard current tree and load a new one from file
+*/
+bool load(const char *fname)
+{
+	char msg[MAX_SAY_CHARS];
+	char question[MAX_ENTRY_LEN];
+	struct file_stamp stamp;
+	struct reader rd;
+	struct tree *t;
+	enum errcode err;
+	bool recover = false;
+	int scroll = 0, i;
+	FILE *f;
+	double start = stats_clock();
+
+	if (strlen(fname) == 0) {
+		say("No filename given.");
+		return false;
+	}
+	if (!modified_warning()) {
+		if (sayblink == 0)
+			say("Cancelled.");
+		return false;
+	}
+
+	f = fopen(fname, "r");
+	if (f == NULL) {
+		snprintf(msg, sizeof(msg), "%s%s",
+				errstrings[ERR_FILENOTFOUND], fname);
+		say(msg);
+		return false;
+	}
+	stamp_file(fname, &stamp);
+	/* if the indentation is broken, offer to read the file again
+	   attaching mis-indented lines to the nearest valid parent */
+	for (;;) {
+		t = add_child(NULL, "Entries");
+		if (format_of(fname) != EXPORT_TEXT) {
+			err = import_tree(&rd, f, format_of(fname), t);
+			/* the folds are kept by preorder whatever the format */
+			if (err == ERR_NONE && (rd.folds = open_state(fname, &rd,
+							&scroll)) != NULL) {
+				for (i = 0; i < t->nchild; i++) {
+					read_folds(t->child[i], &rd);
+				}
+				fclose(rd.folds);
+			}
+			break;
 		}
+		reader_init(&rd, f);
+		rd.recover = recover;
+		rd.folds = recover ? NULL : open_state(fname, &rd, &scroll);
+		err = read_forest(&rd, t);
+		if (rd.folds != NULL)
+			fclose(rd.folds);
+		if (err != ERR_FORMAT || recover)
+			break;
+		free_tree(t);
+		t = NULL;
+		snprintf(question, sizeof(question), "Line %ld, column %d: %s. "
+				"Recover? (y/n)", rd.line, rd.column, rd.msg);
+		if (!confirm(question))
+			break;
+		rewind(f);
+		recover = true;
+		scroll = 0;
+	}
+	fclose(f);
+
+	/* on error keep the current tree and discard everything read */
+	if (err != ERR_NONE) {
+		snprintf(msg, sizeof(msg), "Line %ld:%d: %s",
+				rd.line, rd.column, rd.msg);
+		say(msg);
+		if (t != NULL)
+			free_tree(t);
+		reader_free(&rd);
+		return false;
+	}
+	if (root != NULL) {
+		drop_recovery();
+		free_tree(root);
+	}
+	forget_undo();
+	root = t;
+	selected_entry = rd.selected != NULL ? rd.selected : root;
+	vscroll = scroll;
+	reset_panes();
+	strcpy(filename, fname);
+	saved_hash = recover_hash = tree_hash(root);
+	repaired = rd.nproblems > 0;
+	disk_stamp = seen_stamp = stamp;
+	watch_file(fname);
+	stats.load = stats_clock() - start;
+
+	/* the repairs only exist in memory until the tree is saved */
+	if (rd.nproblems > 0) {
+		long index = rd.problems[0].line - 1;
+		struct tree *first = nth_entry(root, &index);
+		changed();
+		if (first != NULL)
+			reveal(first);
+		snprintf(msg, sizeof(msg), "Fixed %d lines, first at %ld:%d",
+				rd.nproblems, rd.problems[0].line,
+				rd.problems[0].column);
+		say(msg);
+	}
+	reader_free(&rd);
+	return true;
+}
+
+/******************************************************************************
+	Copy the current document's globals into its buffer, creating the
+	first buffer if there isn't one yet
+*/
+void store_buffer()
+{
+	struct buffer *b;
+	if (nbuffers == 0) {
+		buffers_alloc = 4;
+		buffers = malloc(sizeof(*buffers) * buffers_alloc);
+		nbuffers = 1;
+		current_buffer = 0;
+	}
+	b = &buffers[current_buffer];
+	b->root = root;
+	b->selected = selected_entry;
+	strcpy(b->filename, filename);
+	b->saved_hash = saved_hash;
+	b->repaired = repaired;
+	b->recover_hash = recover_hash;
+	b->disk_stamp = disk_stamp;
+	b->seen_stamp = seen_stamp;
+	b->vscroll = vscroll;
+	b->undo_nodes = undo_nodes;
+	b->undo_kids = undo_kids;
+	b->undo_nnodes = undo_nnodes;
+}
+
+/******************************************************************************
+	Make buffer i current, storing the current one first. Only pointers
+	are copied, so switching costs nothing however big the documents are
+*/
+void use_buffer(int i)
+{
+	/* the focused pane's folds go with the tree it's leaving */
+	merge_marks(&panes[current_pane].folds);
+	store_buffer();
+	restore_buffer(i);
+}
+
+/******************************************************************************
+	Copy buffer i into the globals without storing the current one
+*/
+void restore_buffer(int i)
+{
+	struct buffer *b = &buffers[i];
+	current_buffer = i;
+	root = b->root;
+	selected_entry = b->selected;
+	strcpy(filename, b->filename);
+	saved_hash = b->saved_hash;
+	repaired = b->repaired;
+	recover_hash = b->recover_hash;
+	disk_stamp = b->disk_stamp;
+	seen_stamp = b->seen_stamp;
+	vscroll = b->vscroll;
+	undo_nodes = b->undo_nodes;
+	undo_kids = b->undo_kids;
+	undo_nnodes = b->undo_nnodes;
+	reset_panes();
+	watch_file(filename);
+}
+
+/******************************************************************************
+	Switch to buffer i, wrapping around at either end
+*/
+void switch_buffer(int i)
+{
+	char msg[MAX_SAY_CHARS];
+	store_buffer();
+	if (nbuffers < 2) {
+		say("No other buffers.");
+		return;
+	}
+	use_buffer((i + nbuffers) % nbuffers);
+	sprintf(msg, "Buffer %d of %d", current_buffer + 1, nbuffers);
+	say(msg);
+	/* it may have changed while another buffer was watched */
+	check_disk();
+}
+
+/******************************************************************************
+	Open fname in a buffer of its own, or switch to it if it's already
+	open in another. Opening the current buffer's file reloads it, after
+	asking if there are unsaved changes. An untouched empty document is
+	replaced rather than kept
+*/
+void open_buffer(const char *fname)
+{
+	int i, prev;
+
+	store_buffer();
+	for (i = 0; i < nbuffers; i++) {
+		if (i != current_buffer && strlen(fname) > 0
+				&& strcmp(buffers[i].filename, fname) == 0) {
+			switch_buffer(i);
+			return;
+		}
+	}
+	if ((strlen(fname) > 0 && strcmp(filename, fname) == 0)
+			|| (strlen(filename) == 0 && !is_modified()
+			&& (root == NULL || root->nchild == 0))) {
+		if (load(fname))
+			offer_recovery();
+		return;
+	}
+	if (nbuffers == buffers_alloc) {
+		buffers_alloc *= 2;
+		buffers = realloc(buffers, sizeof(*buffers) * buffers_alloc);
+	}
+	prev = current_buffer;
+	memset(&buffers[nbuffers], 0, sizeof(*buffers));
+	use_buffer(nbuffers++);
+	if (!load(fname)) {
+		/* nothing was loaded, so there's nothing to free */
+		nbuffers--;
+		restore_buffer(prev);
+		return;
+	}
+	offer_recovery();
+}
+
+/******************************************************************************
+	Close the current buffer, asking first if it has unsaved changes
+*/
+void close_buffer()
+{
+	int i;
+	store_buffer();
+	if (nbuffers < 2) {
+		say("Last buffer, Shift+Q to quit");
+		return;
+	}
+	if (!modified_warning())
+		return;
+	if (!is_modified() && strlen(filename) > 0)
+		save_state(filename);
+	drop_recovery();
+	free_tree(root);
+	forget_undo();
+	for (i = current_buffer; i < nbuffers - 1; i++) {
+		buffers[i] = buffers[i+1];
+	}
+	nbuffers--;
+	restore_buffer(current_buffer < nbuffers ? current_buffer : 0);
+	say("Buffer closed.");
+}
+
+/******************************************************************************
+	Check every buffer for unsaved changes before quitting, showing each
+	modified one as it's asked about, and remember the folds of the rest.
+	Returns false if the user wants to keep one
+*/
+bool quit_buffers()
+{
+	int i;
+	store_buffer();
+	for (i = 0; i < nbuffers; i++) {
+		if (buffers[i].root == NULL || (!buffers[i].repaired
+				&& tree_hash(buffers[i].root) == buffers[i].saved_hash))
+			continue;
+		use_buffer(i);
+		redraw();
+		paint();
+		if (!modified_warning())
+			return false;
+	}
+	for (i = 0; i < nbuffers; i++) {
+		use_buffer(i);
+		if (!is_modified() && strlen(filename) > 0)
+			save_state(filename);
+		drop_recovery();
 	}
+	return true;
 }
 
 /******************************************************************************
-	Write a tree recursively to file
+	Read the open file again and patch the tree to match it, keeping the
+	nodes, folds and selection of everything that didn't change. Any
+	unsaved changes are lost
 */
-void write_tree(struct tree *t, FILE *f, int depth)
+bool reload()
 {
-	int i;
-	for (i = 0; i < depth; i++) {
-		fprintf(f, "\t");
+	char msg[MAX_SAY_CHARS];
+	struct file_stamp stamp;
+	struct reader rd;
+	struct tree *t;
+	enum errcode err;
+	long added = 0, removed = 0;
+	double start = stats_clock();
+	FILE *f;
+
+	f = fopen(filename, "r");
+	if (f == NULL) {
+		snprintf(msg, sizeof(msg), "%s%s",
+				errstrings[ERR_FILENOTFOUND], filename);
+		say(msg);
+		return false;
 	}
-	fprintf(f, "%s\n", t->text);
-	for (i = 0; i < t->nchild; i++) {
-		write_tree(t->child[i], f, depth+1);
+	stamp_file(filename, &stamp);
+	t = add_child(NULL, "Entries");
+	err = import_tree(&rd, f, format_of(filename), t);
+	fclose(f);
+	if (err != ERR_NONE) {
+		/* most likely caught halfway through a write; wait for the
+		   next change rather than reading this version again */
+		snprintf(msg, sizeof(msg), "Reload failed at %ld:%d",
+				rd.line, rd.column);
+		say(msg);
+		seen_stamp = stamp;
+		free_tree(t);
+		reader_free(&rd);
+		return false;
 	}
+	reader_free(&rd);
+
+	if (tree_hash(root) != tree_hash(t))
+		patch_children(root, t, &added, &removed);
+	free_tree(t);
+	forget_undo();
+	disk_stamp = seen_stamp = stamp;
+	drop_recovery();
+	saved_hash = recover_hash = tree_hash(root);
+	repaired = false;
+	stats.load = stats_clock() - start;
+	if (added + removed > 0)
+		snprintf(msg, sizeof(msg), "Reloaded, +%ld -%ld", added, removed);
+	else
+		snprintf(msg, sizeof(msg), "Reloaded, no changes");
+	say(msg);
+	return true;
 }
 
 /******************************************************************************
-	Read a tree recursively from file
+	Reload the open file if another program wrote it, or if there are
+	unsaved changes, say so once. Returns true if the tree was reloaded
 */
-struct tree *read_tree(FILE *f, char delim, int indent) 
+bool check_disk()
 {
-	char buf[MAX_ENTRY_LEN];
-	int i;
-	int len;
-	struct tree *t;
-	fpos_t fp;
-	int c;
-	int dcount;
-
-	t = malloc(sizeof(*t));
-	t->nchild = t->nalloc = 0;
-
-	/* save beginnning of line */
-	if (fgetpos(f, &fp) < 0 && errno != 0)
-		raise(ERR_IO, strerror(errno));
-
-	/*
-		If delim is '\0', value will be set to the first whitespace
-		character encountered at the beginning of a line
-	*/
-	if (delim == '\0') {
-		c = fgetc(f);
-		if (c == ' ' || c == '\t')
-			delim = c;
-		if (ungetc(c, f) == EOF && errno != 0)
-			raise(ERR_IO, strerror(errno));
-	}
-
-	/* ensure consistent indentation */ 
-	dcount = 0;
-	c = fgetc(f);
-	while (c == delim) {
-		dcount++;
-		c = fgetc(f);
-	}
-	if (ungetc(c, f) == EOF && errno != 0) 
-		raise(ERR_IO, strerror(errno));
-
-	if (dcount != indent)
-		raise(ERR_FORMAT, "invalid indentation");
-	if (fgets(buf, MAX_ENTRY_LEN, f) == NULL && errno != 0)
-		raise(ERR_IO, strerror(errno));
-
-	len = strlen(buf);
-	if (buf[len-1] == '\n') {
-		/* remove trailing newline */
-		buf[--len] = '\0';
-	} else {
-		/* we didn't finish reading the line. discard the rest */
-		int c = fgetc(f);
-		while (c != '\n' && c != EOF) {
-			c = fgetc(f);
-		}
+	struct file_stamp now;
+	if (strlen(filename) == 0 || root == NULL)
+		return false;
+	stamp_file(filename, &now);
+	if (!now.exists || same_stamp(&now, &disk_stamp)
+			|| same_stamp(&now, &seen_stamp))
+		return false;
+	seen_stamp = now;
+	if (is_modified()) {
+		say("File changed on disk, R reloads");
+		return false;
 	}
-	t->text = malloc(len+1);
-	memcpy(t->text, buf, len+1);
-	t->parent = NULL;
-	t->state = COLLAPSED;
-
-	for (;;) {
-		if (fgetpos(f, &fp) < 0 && errno != 0)
-			raise(ERR_IO, strerror(errno));
-		dcount = 0;
-		c = fgetc(f);
-		while (c == delim) {
-			dcount++;
-			c = fgetc(f);
-		}
-		if (c == EOF)
-			return t;
-		if (fsetpos(f, &fp) < 0 && errno != 0)
-			raise(ERR_IO, strerror(errno));
-		if (dcount <= indent)
-			return t;
-		if (dcount > indent+1)
-			raise(ERR_FORMAT, "invalid indentation");
-
-		t->nalloc++;
-		t->nchild++;
-		t->child = realloc(t->child, sizeof(*t->child) * t->nalloc);
-		if (t->child == NULL)
-			raise(ERR_ALLOC, "realloc failed");
-		t->child[t->nchild-1] = read_tree(f, delim, indent+1);
-		t->child[t->nchild-1]->parent = t;
-	}	
-	return NULL; /* unreachable */
+	return reload();
 }
 
 /******************************************************************************
-	Save the current tree to the specified file
+	Make old's children match new's. Each of new's children is paired
+	with an unused child of old with the same text, which is kept and
+	patched in turn; the rest are moved over from new. Children of old
+	with no partner are freed. new is left without children, and the
+	nodes of it that weren't moved are freed, except new itself
 */
-void saveas(const char *fname)
+void patch_children(struct tree *old, struct tree *new, long *added,
+		long *removed)
 {
-	FILE *f;
-	int i;
+	struct tree **sorted = NULL, **order;
+	char *used = NULL;
+	int n = old->nchild;
+	int i, k, lo, hi, mid;
 
-	if (fname == NULL || strlen(fname) == 0) {
-		say("No filename given.");
+	if (n == 0 && new->nchild == 0)
 		return;
+	/* old's children sorted by text, to find partners in O(log n) */
+	if (n > 0) {
+		sorted = malloc(sizeof(*sorted) * n);
+		used = calloc(n, 1);
+		memcpy(sorted, old->child, sizeof(*sorted) * n);
+		qsort(sorted, n, sizeof(*sorted), cmp_text);
 	}
-
-	if (strcmp(fname, filename) != 0) {
-		/* Warn if overwriting */
-		f = fopen(fname, "r");
-		if (f) {
-			fclose(f);
-			if (!confirm("File exists, overwrite? (y/n)")) {
-				say("Save cancelled.");
-				return;
-			}
+	order = malloc(sizeof(*order) * (new->nchild + 1));
+	for (i = 0; i < new->nchild; i++) {
+		struct tree *c = new->child[i];
+		/* the first unused child of old with c's text */
+		lo = 0;
+		hi = n;
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			if (strcmp(sorted[mid]->text, c->text) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (k = lo; k < n && used[k]; k++)
+			;
+		if (k < n && strcmp(sorted[k]->text, c->text) == 0) {
+			used[k] = 1;
+			order[i] = sorted[k];
+			if (tree_hash(sorted[k]) != tree_hash(c))
+				patch_children(sorted[k], c, added, removed);
+		} else {
+			order[i] = c;
+			*added += c->ndesc + 1;
 		}
 	}
-	f = fopen(fname, "w");
-
-	if (!f) {
-		say("Error opening file.");
-		return;
+	/* move the selections out of children about to go */
+	for (k = 0; k < n; k++) {
+		if (!used[k])
+			unlink_node(sorted[k]);
 	}
-	
-	for (i = 0; i < root->nchild; i++) {
-		write_tree(root->child[i], f, 0);
+	set_children(old, order, new->nchild);
+	for (k = 0; k < n; k++) {
+		if (!used[k]) {
+			*removed += sorted[k]->ndesc + 1;
+			free_tree(sorted[k]);
+		}
 	}
-	fclose(f);
-
-	strcpy(filename, fname);
-	modified = false;
-
-	say("Saved.");
+	/* new's children that found a partner have had theirs taken */
+	for (i = 0; i < new->nchild; i++) {
+		if (order[i] != new->child[i])
+			free_tree(new->child[i]);
+	}
+	new->nchild = 0;
+	free(order);
+	free(sorted);
+	free(used);
 }
 
 /******************************************************************************
-	If a working file exists, save to it. Otherwise prompt for a filename
+	Move every pane's selection out of t's branch before t is freed
 */
-void save()
+void unlink_node(struct tree *t)
 {
-	if (strlen(filename) == 0) {
-		saveas(prompt("Save as...", NULL));
-		return;
+	struct tree *p;
+	unlink_panes(t);
+	for (p = selected_entry; p != NULL; p = p->parent) {
+		if (p == t) {
+			selected_entry = t->parent;
+			break;
+		}
 	}
-	saveas(filename);	
 }
 
 /******************************************************************************
-	Discard current tree and load a new one from file
+	qsort comparison of node pointers by text
 */
-bool load(const char *fname)
+int cmp_text(const void *a, const void *b)
 {
-	bool success = false;
-	FILE *f = NULL;
+	const struct tree *ta = *(struct tree * const *)a;
+	const struct tree *tb = *(struct tree * const *)b;
+	return strcmp(ta->text, tb->text);
+}
 
-	if (strlen(fname) == 0) {
-		say("No filename given.");
-		return false;
+/******************************************************************************
+	Return the index'th entry below t in preorder, not counting t itself,
+	or NULL if there are fewer entries. index is counted down as entries
+	are passed
+*/
+struct tree *nth_entry(struct tree *t, long *index)
+{
+	struct tree *found;
+	int i;
+	for (i = 0; i < t->nchild; i++) {
+		if ((*index)-- == 0)
+			return t->child[i];
+		/* skip whole subtrees that end before the index */
+		if (*index >= t->child[i]->ndesc) {
+			*index -= t->child[i]->ndesc;
+			continue;
+		}
+		if ((found = nth_entry(t->child[i], index)) != NULL)
+			return found;
 	}
+	return NULL;
+}
 
-	if (modified_warning()) {
-		if (try()) {
-			f = fopen(fname, "r");
-
-			if (!f) {
-				raise(ERR_FILENOTFOUND, fname); 
-			}
-			if (root != NULL) {
-				free_tree(root);
-			}
-			root = add_child(NULL, "Entries");
-			selected_entry = root;
-
-			while (!feof(f)) {
-				add_leaf(root, read_tree(f, '\0', 0));
-			}
-			fclose(f);
-			strcpy(filename, fname);
-			modified = false;
-			success = true;
-		} else { /* error handling */
-			if (catch(ERR_FILENOTFOUND)
-	/*			|| catch(ERR_IO) */
-				|| catch(ERR_FORMAT)) {
-				say(get_error());
-				if (f != NULL) {
-					fclose(f);
-				}
-				/* discard the partial load */
-				if (root != NULL) {
-					free_tree(root);
-					root = add_child(NULL, "Entries");
-				}
-			}
+/******************************************************************************
+	Select t, expanding its ancestors and scrolling it onscreen
+*/
+void reveal(struct tree *t)
+{
+	struct tree *p, *v;
+	long row;
+
+	/* the rows change below the outermost fold that hid t */
+	v = visible_ancestor(t);
+	if (npanes > 1) {
+		/* a split pane marks only the ancestors it shows collapsed */
+		while (v != t) {
+			set_mark(v, EXPANDED, FOLD_NONE);
+			v = visible_ancestor(t);
 		}
-		finally();
-	} else if (sayblink == 0) {
-		say("Cancelled.");
-		return false;
+	} else {
+		for (p = t->parent; p != NULL; p = p->parent) {
+			p->state = EXPANDED;
+		}
+		if (v != t)
+			reshaped(v, 0);
+	}
+	selected_entry = t;
+	row = row_of(t);
+	if (row < vscroll || row >= vscroll + tree_win_height) {
+		vscroll = row - tree_win_height / 2;
+		if (vscroll < 0)
+			vscroll = 0;
 	}
-	return success;
 }
 
 /******************************************************************************
@@ -886,12 +2369,12 @@ bool load(const char *fname)
 */
 void draw_info(int y, int x, const char *key, const char *label)
 {
-	wmove(help_window, y, x);
-	wattron(help_window, A_REVERSE | A_BOLD);
-	waddstr(help_window, key);
-	wattroff(help_window, A_REVERSE | A_BOLD);
-	waddstr(help_window, " ");
-	waddstr(help_window, label);
+	r_move(&help_view, y, x);
+	r_attron(&help_view, A_REVERSE | A_BOLD);
+	r_addstr(&help_view, key);
+	r_attroff(&help_view, A_REVERSE | A_BOLD);
+	r_addstr(&help_view, " ");
+	r_addstr(&help_view, label);
 }
 
 /******************************************************************************
@@ -902,40 +2385,67 @@ void status()
 	int plen = strlen(PROGRAM " " VERSION);
 	int i;
 	int flen;
-	wmove(status_window, 0, 0);
-	wattron(status_window, A_REVERSE);
+	r_move(&status_view, 0, 0);
+	r_attron(&status_view, A_REVERSE);
 	for (i = 0; i < screenw; i++) {
-		waddstr(status_window, " ");
+		r_addstr(&status_view, " ");
 	}
-	wmove(status_window, 0, 0);
-	wattron(status_window, A_BOLD);
+	r_move(&status_view, 0, 0);
+	r_attron(&status_view, A_BOLD);
 	if (strlen(filename) == 0) {
-		waddstr(status_window, "[Untitled]");
+		r_addstr(&status_view, "[Untitled]");
 		flen = 10;         
 	} else {
-		waddstr(status_window, filename);
+		r_addstr(&status_view, filename);
 		flen = strlen(filename);
 	}
-	if (modified) {
-		wmove(status_window, 0, flen);
-		waddstr(status_window, "*");
+	if (is_modified()) {
+		r_move(&status_view, 0, flen);
+		r_addstr(&status_view, "*");
 		flen++;
 	}
-	wmove(status_window, 0, screenw-plen);
-	waddstr(status_window, PROGRAM " " VERSION);
-	wattroff(status_window, A_BOLD);
+	if (nbuffers > 1) {
+		char count[32];
+		sprintf(count, " [%d/%d]", current_buffer + 1, nbuffers);
+		r_move(&status_view, 0, flen);
+		r_addstr(&status_view, count);
+		flen += strlen(count);
+	}
+	r_move(&status_view, 0, screenw-plen);
+	r_addstr(&status_view, PROGRAM " " VERSION);
+	r_attroff(&status_view, A_BOLD);
 
 	if (strlen(saymsg) > 0) {
-		wmove(status_window, 0, screenw - plen - strlen(saymsg) - 2 - 4);
+		r_move(&status_view, 0, screenw - plen - strlen(saymsg) - 2 - 4);
 		if (sayblink > 1 && sayblink % 2 == 0) {
-			wattron(status_window, A_BOLD);
+			r_attron(&status_view, A_BOLD);
 		}
-		waddstr(status_window, "> ");
-		waddstr(status_window, saymsg);
-		wattroff(status_window, A_BOLD);
-		waddstr(status_window, "    ");
+		r_addstr(&status_view, "> ");
+		r_addstr(&status_view, saymsg);
+		r_attroff(&status_view, A_BOLD);
+		r_addstr(&status_view, "    ");
+	}
+	r_attroff(&status_view, A_REVERSE);
+}
+
+/******************************************************************************
+	Draw the stats overlay
+*/
+void draw_stats()
+{
+	char line[256];
+	int len;
+	stats_line(line, sizeof(line));
+	len = strlen(line);
+	if (selected_entry != NULL) {
+		snprintf(line + len, sizeof(line) - len,
+				"  |  selected: %ld below, %d deep, %.1fK",
+				selected_entry->ndesc, selected_entry->height,
+				selected_entry->tbytes / 1024.0);
 	}
-	wattroff(status_window, A_REVERSE);
+	r_move(&stats_view, 0, 0);
+	r_addnstr(&stats_view, line, screenw);
+	r_clrtoeol(&stats_view);
 }
 
 /******************************************************************************
@@ -943,11 +2453,11 @@ void status()
 */
 void help_normal()
 {
-	int col = screenw / 6;
-	wmove(help_window, 1, 0);
-	wclrtoeol(help_window);
-	wmove(help_window, 0, 0);
-	wclrtoeol(help_window);
+	int col = screenw / 10;
+	r_move(&help_view, 1, 0);
+	r_clrtoeol(&help_view);
+	r_move(&help_view, 0, 0);
+	r_clrtoeol(&help_view);
 	draw_info(0, 0 * col, " i ", "New");
 	draw_info(1, 0 * col, " e ", "Edit");
 	draw_info(0, 1 * col, " H ", "Promote");
@@ -955,10 +2465,18 @@ void help_normal()
 	draw_info(0, 2 * col, " K ", "Move Up");
 	draw_info(1, 2 * col, " J ", "Move Dn");
 	draw_info(0, 3 * col, " D ", "Delete");
+	draw_info(1, 3 * col, " T ", "Stats");
 	draw_info(0, 4 * col, " S ", "Save");
 	draw_info(1, 4 * col, " O ", "Open");
 	draw_info(0, 5 * col, " A ", "Save as");
 	draw_info(1, 5 * col, " Q ", "Quit");
+	draw_info(0, 6 * col, " o ", "Sort");
+	draw_info(1, 6 * col, " u ", "Undo");
+	draw_info(0, 7 * col, " > ", "Open all");
+	draw_info(1, 7 * col, " < ", "Fold all");
+	draw_info(0, 8 * col, " / ", "Find tag");
+	draw_info(1, 8 * col, " n ", "Next");
+	draw_info(0, 9 * col, " X ", "Export");
 }
 
 /******************************************************************************
@@ -966,11 +2484,11 @@ void help_normal()
 */
 void help_edit()
 {
-	int col = screenw / 6;
-	wmove(help_window, 1, 0);
-	wclrtoeol(help_window);
-	wmove(help_window, 0, 0);
-	wclrtoeol(help_window);
+	int col = screenw / 7;
+	r_move(&help_view, 1, 0);
+	r_clrtoeol(&help_view);
+	r_move(&help_view, 0, 0);
+	r_clrtoeol(&help_view);
 	draw_info(0, 0 * col, "C-a", "Home");
 	draw_info(1, 0 * col, "C-e", "End");
 	draw_info(0, 1 * col, "C-h", "Backsp");
@@ -981,8 +2499,10 @@ void help_edit()
 	draw_info(1, 3 * col, "C-u", "CutLineL");
 	draw_info(0, 4 * col, "C-w", "CutWordL");
 	draw_info(1, 4 * col, "C-x", "CutWordR");
-	draw_info(0, 5 * col, "C-v", "Paste");
+	draw_info(0, 5 * col, "C-y", "Paste");
 	draw_info(1, 5 * col, "C-?", "Hide Help");
+	draw_info(0, 6 * col, "Tab", "Complete");
+	draw_info(1, 6 * col, "Up", "History");
 }
 
 /******************************************************************************
@@ -990,7 +2510,8 @@ void help_edit()
 */
 void say(const char *str)
 {
-	strcpy(saymsg, str);
+	strncpy(saymsg, str, MAX_SAY_CHARS - 1);
+	saymsg[MAX_SAY_CHARS - 1] = '\0';
 	if (strlen(str) > 0)
 		sayblink = 2 * SAY_BLINKS;
 }
@@ -1009,13 +2530,31 @@ void squelch()
 */
 void redraw()
 {
-	print_tree(root, 0);
+	double start = stats_clock();
+	int focus = current_pane;
+	int i;
+
+	/* the unfocused panes first, so the globals end up focused */
+	stats.visited = 0;
+	store_pane();
+	for (i = 0; i < npanes; i++) {
+		if (i == focus)
+			continue;
+		restore_pane(i);
+		print_tree(A_UNDERLINE);
+		store_pane();
+	}
+	restore_pane(focus);
+	print_tree(A_STANDOUT);
 	status();
+	if (stats_view.open)
+		draw_stats();
 	switch(help_mode) {
 	case H_NORMAL: help_normal(); break;
 	case H_EDIT: help_edit(); break;
 	default: break;
 	}
+	stats.redraw = stats_clock() - start;
 }
 
 /******************************************************************************
@@ -1025,6 +2564,8 @@ bool confirm(const char *question)
 {
 	char *str, ans;
 	str = prompt(question, NULL);
+	if (str == NULL)
+		return false;
 	ans = str[0];
 	free(str);
 	if (ans == 'y')
@@ -1034,12 +2575,130 @@ bool confirm(const char *question)
 	return false;
 }
 
+/******************************************************************************
+	Write a snapshot of each buffer that changed since its last one to
+	its recovery file, or remove the file if the buffer now matches what
+	was saved. The snapshot is taken here, since the tree can't be read
+	while it's being edited, and written by the autosave thread
+*/
+void autosave()
+{
+	char rname[MAX_ENTRY_LEN + sizeof(RECOVER_SUFFIX) + 16];
+	unsigned long h;
+	char *data;
+	size_t len;
+	FILE *f;
+	int i, j;
+
+	store_buffer();
+	for (i = 0; i < nbuffers; i++) {
+		struct buffer *b = &buffers[i];
+		if (b->root == NULL || (h = tree_hash(b->root)) == b->recover_hash)
+			continue;
+		recover_name(b->filename, rname);
+		b->recover_hash = h;
+		if (h == b->saved_hash) {
+			autosave_remove(rname);
+			continue;
+		}
+		if ((f = open_memstream(&data, &len)) == NULL)
+			continue;
+		for (j = 0; j < b->root->nchild; j++) {
+			write_tree(b->root->child[j], f, 0);
+		}
+		fclose(f);
+		autosave_write(rname, data, len);
+	}
+	recover_hash = buffers[current_buffer].recover_hash;
+	unsaved_edits = 0;
+}
+
+/******************************************************************************
+	Remove the current buffer's recovery file, once its changes are saved
+	or thrown away
+*/
+void drop_recovery()
+{
+	char rname[MAX_ENTRY_LEN + sizeof(RECOVER_SUFFIX) + 16];
+	if (recover_hash == saved_hash)
+		return;
+	recover_name(filename, rname);
+	autosave_remove(rname);
+	recover_hash = saved_hash;
+}
+
+/******************************************************************************
+	If the current file has a recovery file left by a crash, offer to
+	restore the changes in it. They replace the tree but aren't saved.
+	A tree with no file takes over the one of an editor that died
+*/
+void offer_recovery()
+{
+	char rname[MAX_ENTRY_LEN + sizeof(RECOVER_SUFFIX) + 16];
+	char from[MAX_ENTRY_LEN + sizeof(RECOVER_SUFFIX) + 16];
+	char msg[MAX_SAY_CHARS];
+	struct reader rd;
+	struct tree *t;
+	enum errcode err;
+	FILE *f;
+
+	recover_name(filename, rname);
+	strcpy(from, rname);
+	if (strlen(filename) == 0 && !orphan_recovery(from))
+		return;
+	if ((f = fopen(from, "r")) == NULL)
+		return;
+	if (!confirm("Restore unsaved changes? (y/n)")) {
+		fclose(f);
+		remove(from);
+		say("Unsaved changes discarded.");
+		return;
+	}
+	t = add_child(NULL, "Entries");
+	reader_init(&rd, f);
+	err = read_forest(&rd, t);
+	fclose(f);
+
+	/* keep the tree and the recovery file as they are, so that nothing
+	   in either is lost */
+	if (err != ERR_NONE) {
+		snprintf(msg, sizeof(msg), "Line %ld:%d: %s",
+				rd.line, rd.column, rd.msg);
+		say(msg);
+		free_tree(t);
+		reader_free(&rd);
+		return;
+	}
+	reader_free(&rd);
+	if (strcmp(from, rname) != 0)
+		rename(from, rname);
+	if (root != NULL)
+		free_tree(root);
+	forget_undo();
+	root = t;
+	selected_entry = root;
+	vscroll = 0;
+	reset_panes();
+	recover_hash = tree_hash(root);
+	say("Unsaved changes restored.");
+}
+
+/******************************************************************************
+	Return true if the tree differs from the file as last loaded or
+	saved, repairs made while loading it included. Only the parts
+	edited since the last call are rehashed
+*/
+bool is_modified()
+{
+	return root != NULL && (repaired || tree_hash(root) != saved_hash);
+}
+
 /******************************************************************************
 	Returns true if the user doesn't want to save changes
 */
 bool modified_warning()
 {
-	if (!modified)
+	if (!is_modified())
 		return true;
 	return confirm("Discard unsaved changes? (y/n)");
 }
@@ -1050,11 +2709,14 @@ bool modified_warning()
 void delete()
 {
 	if (confirm("Delete entry? (y/n)")) {
-		struct tree *t = del_child(selected_entry);
+		struct tree *t = selected_entry;
+		if (t != NULL && t->parent != NULL)
+			unlink_node(t);
+		t = del_child(t);
 		if (t != NULL && t != root) {
 			free_tree(t);
 			say("Entry deleted.");
-			modified = true;
+			changed();
 		} else if (t == root) {
 			say("Cannot delete root entry.");
 		} else {
@@ -1066,141 +2728,368 @@ void delete()
 }
 
 /******************************************************************************
-	Enter the main runtime loop and wait for commands
+	Record a change to the tree. Any change other than a sort makes the
+	last sort impossible to undo
 */
-void menu()
+void changed()
 {
-	char *tmpstr;
-	int c = 0;
-	keypad(tree_window, TRUE);
-	while (c != 'Q') {
-		redraw();
-		wrefresh(tree_window);
-		do {
-			status();
-			wrefresh(status_window);
-			if (sayblink) {
-				sayblink--;
-				napms(SAY_DURATION);
-			}
-		} while (sayblink > 0);
-		if (help_window)
-			wrefresh(help_window);
-		say("");
-		c = wgetch(tree_window);
-		switch(c) {
-		case 0x03: /* Ctrl+C */
-		case 'q':
-			say("Shift+Q to quit");
-			break;
-		case 'Q':
-			if (!modified_warning())
-				c = '\0';
-			break;
-		case 'K':
-			shove_up();
-			break;
-		case 'k':
-		case KEY_UP:
-			select_up();
-			break;
-		case 'J':
-			shove_down();
-			break;
-		case 'j':
-		case KEY_DOWN:
-			select_down();
-			break;
-		case 'L':
-			demote();
-			break;
-		case 'l': 
-		case KEY_RIGHT:
-			set_fold(EXPANDED);
-			break;
-		case 'H':
-			promote();
-			break;
-		case 'h':
-		case KEY_LEFT:
-			set_fold(COLLAPSED);
-			break;
-		case 'i':
-			insert_entry();
-			break;
-		case 'e':
-			edit_entry();
-			break;
-		case 'D':
-			delete();
-			break;
-		case 'A':
-			tmpstr = prompt("Save as...", filename); 
-			if (tmpstr != NULL) {
-				saveas(tmpstr);
-				free(tmpstr);
-			}
+	unsaved_edits++;
+	forget_undo();
+}
+
+/******************************************************************************
+	Discard the copy of the children kept to undo the last sort
+*/
+void forget_undo()
+{
+	free(undo_nodes);
+	free(undo_kids);
+	undo_nodes = NULL;
+	undo_kids = NULL;
+	undo_nnodes = 0;
+}
+
+/******************************************************************************
+	Count, and if undo_nodes is allocated copy, the children of t and if
+	recursive its descendants, skipping nodes a sort can't reorder
+*/
+void record_children(struct tree *t, bool recursive, long *nodes,
+		long *kids)
+{
+	int i;
+	if (t->nchild > 1) {
+		if (undo_nodes != NULL) {
+			undo_nodes[*nodes] = t;
+			memcpy(&undo_kids[*kids], t->child,
+					sizeof(*t->child) * t->nchild);
+		}
+		(*nodes)++;
+		*kids += t->nchild;
+	}
+	if (!recursive)
+		return;
+	for (i = 0; i < t->nchild; i++) {
+		record_children(t->child[i], true, nodes, kids);
+	}
+}
+
+/******************************************************************************
+	Ask how to sort the selected entry's children, then sort them
+*/
+void sort_entry()
+{
+	struct tree *t = selected_entry != NULL ? selected_entry : root;
+	enum sort_order order;
+	bool recursive;
+	long nodes = 0, kids = 0;
+	char *str;
+
+	str = prompt("Sort by (a)lphabet, (n)umber or (s)ize? "
+			"Capital sorts the whole branch", NULL);
+	if (str == NULL)
+		return;
+	recursive = isupper((unsigned char)str[0]);
+	switch (tolower((unsigned char)str[0])) {
+	case 'a': order = SORT_ALPHA; break;
+	case 'n': order = SORT_NATURAL; break;
+	case 's': order = SORT_SIZE; break;
+	default:
+		free(str);
+		say("Please type a, n or s.");
+		return;
+	}
+	free(str);
+
+	/* the sort is one change, which can be undone as a whole */
+	changed();
+	record_children(t, recursive, &nodes, &kids);
+	if (nodes > 0) {
+		undo_nodes = malloc(sizeof(*undo_nodes) * nodes);
+		undo_kids = malloc(sizeof(*undo_kids) * kids);
+		undo_nnodes = nodes;
+		nodes = kids = 0;
+		record_children(t, recursive, &nodes, &kids);
+	}
+	sort_tree(t, order, recursive);
+	say("Sorted, u to undo.");
+}
+
+/******************************************************************************
+	Put back the order of the children from before the last sort
+*/
+void undo()
+{
+	long i, k = 0;
+	if (undo_nodes == NULL) {
+		say("Nothing to undo.");
+		return;
+	}
+	for (i = 0; i < undo_nnodes; i++) {
+		struct tree *t = undo_nodes[i];
+		memcpy(t->child, &undo_kids[k], sizeof(*t->child) * t->nchild);
+		k += t->nchild;
+		hash_dirty(t);
+		reshaped(t, 0);
+	}
+	changed();
+	say("Sort undone.");
+}
+
+/******************************************************************************
+	Wait for a key in the focused pane, checking the open file for
+	changes on disk while none comes. A change returns KEY_REFRESH so
+	that the result gets drawn
+*/
+int wait_key()
+{
+	struct file_stamp seen;
+	int c, timeout;
+	keypad(tree_view.win, TRUE);
+	for (;;) {
+		/* checked before each wait too, so typing doesn't starve them */
+		if (watch_poll()) {
+			check_disk();
+			c = KEY_REFRESH;
 			break;
-		case 'S':
-			save();
+		}
+		if (unsaved_edits >= AUTOSAVE_EDITS || (unsaved_edits > 0
+					&& stats_clock() - last_input
+					>= AUTOSAVE_IDLE / 1000.0))
+			autosave();
+		timeout = watching() ? WATCH_POLL
+			: unsaved_edits > 0 ? AUTOSAVE_IDLE : -1;
+		wtimeout(tree_view.win, timeout);
+		c = wgetch(tree_view.win);
+		if (c != ERR || timeout < 0)
 			break;
-		case 'O':
-			tmpstr = prompt("Open...", filename);
-			if (tmpstr != NULL) {
-	 			load(tmpstr);
-	 			free(tmpstr);
+		/* with no events to wake on, look at the file each time the
+		   wait runs out. check_disk notes any change it sees */
+		if (watch_polling()) {
+			seen = seen_stamp;
+			check_disk();
+			if (!same_stamp(&seen, &seen_stamp)) {
+				c = KEY_REFRESH;
+				break;
 			}
-			break;
-		case 0x1F: /* C-? */
-		case '?':
-			help_mode = help_mode == H_HIDE ? H_NORMAL : H_HIDE;
-			resize();
-			break;
-		default:
-			break;
 		}
 	}
+	wtimeout(tree_view.win, -1);
+	last_input = stats_clock();
+	return c;
 }
 
 /******************************************************************************
-	Entry point
+	Return a key that has already been typed, or ERR if there's none,
+	without waiting
 */
-int main(int argc, char *argv[])
+int pending_key()
 {
-	(void)(argc);
-	(void)(argv);
+	int c;
+	keypad(tree_view.win, TRUE);
+	wtimeout(tree_view.win, 0);
+	c = wgetch(tree_view.win);
+	wtimeout(tree_view.win, -1);
+	if (c != ERR)
+		last_input = stats_clock();
+	return c;
+}
 
-	modified = false;
-	help_mode = SHOW_HELP_DEFAULT ? H_NORMAL : H_HIDE;
-	memset(filename, 0, MAX_ENTRY_LEN);
+/******************************************************************************
+	Queue every visible section for output and send it to the terminal
+*/
+void paint()
+{
+	refresh_panes();
+	r_refresh(&stats_view);
+	r_refresh(&status_view);
+	r_refresh(&help_view);
+	r_update();
+}
 
-	if (argc > 1) {
-		if(!load(argv[1])) {
-			FILE *f = fopen(argv[1], "w");		
-			if (f) {
-				char temp[MAX_SAY_CHARS];
-				int len = strlen(argv[1]);
-				if (len > MAX_ENTRY_LEN-1)
-					len = MAX_ENTRY_LEN-1;
-				sprintf(temp, "Created '%s'", argv[1]);
-				fclose(f);
-				load(argv[1]);
-				squelch();
-				say(temp);
-				memcpy(filename, argv[1], len);
-				filename[len] = '\0';
-			} else {
-				say("Failed to create file.");
-			}
+/******************************************************************************
+	Perform the command bound to key c. Returns true if it quits
+*/
+bool dispatch(int c)
+{
+	char *tmpstr;
+	switch(c) {
+	case 0x03: /* Ctrl+C */
+	case 'q':
+		say("Shift+Q to quit");
+		break;
+	case 'Q':
+		return quit_buffers();
+	case 'K':
+		shove_up();
+		break;
+	case 'k':
+	case KEY_UP:
+		select_up();
+		break;
+	case 'J':
+		shove_down();
+		break;
+	case 'j':
+	case KEY_DOWN:
+		select_down();
+		break;
+	case 'L':
+		demote();
+		break;
+	case 'l': 
+	case KEY_RIGHT:
+		set_fold(EXPANDED);
+		break;
+	case 'H':
+		promote();
+		break;
+	case '>':
+		fold_branch(FOLD_ALL);
+		break;
+	case '<':
+		fold_branch(0);
+		break;
+	case '1': case '2': case '3': case '4': case '5':
+	case '6': case '7': case '8': case '9':
+		fold_branch(c - '0');
+		break;
+	case 'f':
+		focus();
+		break;
+	case '|':
+		split_view(SPLIT_SIDE);
+		break;
+	case '_':
+		split_view(SPLIT_STACK);
+		break;
+	case 'w':
+		focus_pane(current_pane + 1);
+		break;
+	case 'h':
+	case KEY_LEFT:
+		set_fold(COLLAPSED);
+		break;
+	case 'i':
+		insert_entry();
+		break;
+	case 'e':
+		edit_entry();
+		break;
+	case 'D':
+		delete();
+		break;
+	case 'o':
+		sort_entry();
+		break;
+	case 'u':
+		undo();
+		break;
+	case '/':
+		find_tags();
+		break;
+	case 'n':
+		find_next(1);
+		break;
+	case 'N':
+		find_next(-1);
+		break;
+	case 'A':
+		tmpstr = prompt_complete("Save as...", filename, match_files);
+		if (tmpstr != NULL) {
+			saveas(tmpstr);
+			free(tmpstr);
 		}
-	} else {
-		root = add_child(NULL, "Entries");
+		break;
+	case 'S':
+		save();
+		break;
+	case 'O':
+		tmpstr = prompt_complete("Open...", filename, match_files);
+		if (tmpstr != NULL) {
+ 			open_buffer(tmpstr);
+ 			free(tmpstr);
+		}
+		break;
+	case 'X':
+		tmpstr = prompt_complete("Export as...", NULL, match_files);
+		if (tmpstr != NULL) {
+			export_file(tmpstr);
+			free(tmpstr);
+		}
+		break;
+	case ']':
+		switch_buffer(current_buffer + 1);
+		break;
+	case '[':
+		switch_buffer(current_buffer - 1);
+		break;
+	case 'W':
+		close_buffer();
+		break;
+	case 'R':
+		if (strlen(filename) == 0)
+			say("No file to reload.");
+		else if (modified_warning())
+			reload();
+		break;
+	case 0x1F: /* C-? */
+	case '?':
+		help_mode = help_mode == H_HIDE ? H_NORMAL : H_HIDE;
+		resize();
+		break;
+	case 'T':
+		show_stats = !show_stats;
+		resize();
+		break;
+	case KEY_PASTE:
+		paste_entries();
+		break;
+	case KEY_RESIZE:
+		if (tree_view.win != NULL)
+			settle_resize(tree_view.win);
+		resize();
+		break;
+	default:
+		break;
 	}
-	selected_entry = root;
-
-	init_curses();
-	menu();
-	endwin();
+	return false;
+}
 
-	return 0;
+/******************************************************************************
+	Enter the main runtime loop and wait for commands
+*/
+void menu()
+{
+	double key = 0;
+	bool quit = false;
+	int c;
+	while (!quit) {
+		redraw();
+		refresh_panes();
+		r_refresh(&stats_view);
+		r_update();
+		/* the time since the last key was read, once its result has
+		   been painted. Shown in the overlay after the next key */
+		if (key > 0)
+			stats.latency = stats_clock() - key;
+		do {
+			status();
+			r_refresh(&status_view);
+			r_update();
+			if (sayblink) {
+				sayblink--;
+				napms(SAY_DURATION);
+			}
+		} while (sayblink > 0);
+		r_refresh(&help_view);
+		r_update();
+		say("");
+		quit = dispatch(wait_key());
+		key = stats_clock();
+		/* run the keys typed meanwhile before drawing again, so that
+		   holding a key or pasting commands redraws once per burst */
+		while (!quit && stats_clock() - key < TYPEAHEAD_BUDGET / 1000.0
+				&& (c = pending_key()) != ERR)
+			quit = dispatch(c);
+	}
 }
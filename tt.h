@@ -0,0 +1,321 @@
+#ifndef TT_TT_H
+#define TT_TT_H
+
+#include <ncurses.h>
+#include <stdbool.h>
+
+#include "readline.h"
+#include "render.h"
+#include "tree.h"
+#include "watch.h"
+
+/* Program info displayed in status bar */
+#define PROGRAM "tree tool"
+#define VERSION "v0.2"
+
+/* Size in rows of footer sections */
+#define HELP_SIZE 2
+#define STATUS_SIZE 1
+#define STATS_SIZE 1
+
+/* Set to 0 to hide help on startup*/
+#define SHOW_HELP_DEFAULT 0
+
+/* Duration of blink in ms */
+#define SAY_DURATION 96 
+#define SAY_BLINKS 2
+#define MAX_SAY_CHARS 40
+
+/* Suffix of the hidden file that remembers folds and cursor position */
+#define STATE_SUFFIX ".ttstate"
+
+/* Time in ms to wait for a burst of resize events to settle */
+#define RESIZE_SETTLE 50
+
+/* Time in ms between checks of the open file for changes on disk */
+#define WATCH_POLL 250
+
+/* Suffix of the hidden file unsaved changes are kept in, and the name
+   it's kept under for a tree with no file, followed by the editor's pid */
+#define RECOVER_SUFFIX ".ttrecover"
+#define RECOVER_UNTITLED "untitled"
+
+/* Unsaved changes are written to the recovery file after this many ms
+   without a key, or after this many edits if the keys keep coming */
+#define AUTOSAVE_IDLE 2000
+#define AUTOSAVE_EDITS 100
+
+/* Keys already typed are run without redrawing in between for at most
+   this many ms, so a long burst still shows progress */
+#define TYPEAHEAD_BUDGET 50
+
+/* Most panes the tree view can be split into */
+#define MAX_PANES 2
+
+/* One open document. The globals hold the current buffer's fields
+   while it's in use; they're copied back here when switching away */
+struct buffer {
+	struct tree *root;
+	struct tree *selected;
+	char filename[MAX_ENTRY_LEN];
+	unsigned long saved_hash;
+	bool repaired;
+	unsigned long recover_hash;
+	struct file_stamp disk_stamp;
+	struct file_stamp seen_stamp;
+	int vscroll;
+	struct tree **undo_nodes;
+	struct tree **undo_kids;
+	long undo_nnodes;
+};
+
+/* A fold made in one pane of a split view, which that pane shows instead
+   of the tree's own: t's state there and, unless FOLD_NONE, how many
+   levels below t show, as fold_subtree takes them */
+struct fold_mark {
+	struct tree *t;
+	enum fold_state state;
+	int unfold;
+};
+
+/* The folds a pane has made since the view was split, oldest first. A
+   fold over a whole branch replaces the marks inside it, so the list only
+   grows with the folds made. Marks are looked up through an open
+   addressing table of their indices, -1 where empty */
+struct overlay {
+	struct fold_mark *mark;
+	int n;
+	int alloc;
+	int *slot;
+	int nslots;
+};
+
+/* An entry whose children are still being added to the row index */
+struct row_frame {
+	struct tree *t;
+	int next;       /* index of the next child to add */
+	int unfold;     /* levels the pane's marks leave for the children */
+};
+
+/* A row index kept aside while another is in the view_ globals */
+struct row_index {
+	struct tree **rows;
+	int *depth;
+	long nrows;
+	long alloc;
+	struct row_frame *stack;
+	int nstack;
+	int stack_alloc;
+	unsigned long edits;
+	struct tree *root;
+};
+
+/* A view of the current buffer's tree. The globals tree_view,
+   selected_entry, vscroll, selected_index, tree_win_height and
+   tree_win_width hold the focused pane's fields while it's in use. folds
+   are the ones made in the pane while the view is split, and rows is
+   the pane's own row index, used while it has any */
+struct pane {
+	struct surface view;
+	struct tree *selected;
+	int vscroll;
+	int selected_index;
+	int height, width;
+	struct overlay folds;
+	struct row_index rows;
+};
+
+enum split {
+	SPLIT_NONE,
+	SPLIT_SIDE,     /* panes side by side */
+	SPLIT_STACK     /* panes one above the other */
+};
+
+/* function prototypes */
+void autosave();
+void changed();
+long changed_row(struct tree *p, int i);
+bool check_disk();
+void clear_marks(struct overlay *o);
+int cmp_text(const void *a, const void *b);
+struct tree *collapsed_above(struct tree *t, int *levels);
+void close_buffer();
+long complete_entry(const char *prefix, int len, char ***matches);
+long complete_tags(const char *prefix, int len, char ***matches);
+void cut_rows(long n);
+bool confirm(const char *question);
+bool modified_warning();
+void offer_recovery();
+char *prompt(const char *msgstr, const char *defstr);
+char *prompt_complete(const char *msgstr, const char *defstr,
+		rl_completer complete);
+void delete();
+void demote();
+void die(const char *error);
+void drop_marks(struct overlay *o, struct tree *t, bool keep_t);
+bool dispatch(int c);
+void export_file(const char *fname);
+long extend_rows(long upto);
+void find_next(int dir);
+void find_tags();
+void focus_pane(int i);
+void draw_info(int y, int x, const char *key, const char *label);
+void draw_stats();
+void drop_recovery();
+void edit_entry();
+void focus();
+struct fold_mark *find_mark(struct overlay *o, struct tree *t);
+long find_row(struct tree *t, long from);
+enum fold_state fold_of(struct tree *t);
+void free_rows(struct row_index *ix);
+void fold_branch(int levels);
+void forget_undo();
+void help_normal();
+void help_edit();
+void index_marks(struct overlay *o);
+void init_curses();
+bool is_modified();
+void insert_entry();
+bool load(const char *fname);
+void open_buffer(const char *fname);
+FILE *open_state(const char *fname, struct reader *rd, int *scroll);
+void menu();
+unsigned long mark_hash(struct tree *t);
+enum fold_state mark_fold(struct tree *t, int *levels);
+void merge_marks(struct overlay *o);
+struct tree *nth_entry(struct tree *t, long *index);
+void paint();
+int pending_key();
+char *read_paste(WINDOW *win, size_t *len);
+void paste_entries();
+void paste_mode(bool on);
+void patch_children(struct tree *old, struct tree *new, long *added,
+		long *removed);
+void pane_rect(int i, int *h, int *w, int *y, int *x);
+struct row_index *pane_rows(int i);
+void print_tree(int highlight);
+void push_children(struct tree *t);
+void push_row(struct tree *t);
+bool quit_buffers();
+void promote();
+void record_children(struct tree *t, bool recursive, long *nodes,
+		long *kids);
+void read_folds(struct tree *t, struct reader *rd);
+void redraw();
+bool reload();
+void refresh_panes();
+void reset_panes();
+void resize();
+void restore_buffer(int i);
+void restore_pane(int i);
+void reveal(struct tree *t);
+long row_of(struct tree *t);
+void save();
+void saveas(const char *fname);
+void save_state(const char *fname);
+void say(const char *str);
+void select_down();
+void select_up();
+void set_fold(enum fold_state f);
+void set_mark(struct tree *t, enum fold_state state, int unfold);
+void settle_resize(WINDOW *win);
+void shove_down();
+void shove_up();
+void sort_entry();
+void split_view(enum split mode);
+void squelch();
+void recover_name(const char *fname, char *buf);
+bool orphan_recovery(char *buf);
+void state_name(const char *fname, char *buf);
+void status();
+void store_buffer();
+void store_pane();
+void switch_buffer(int i);
+void undo();
+void unlink_node(struct tree *t);
+void unlink_panes(struct tree *t);
+void use_buffer(int i);
+void use_rows(struct row_index *ix);
+struct tree *visible_ancestor(struct tree *t);
+int wait_key();
+void write_folds(struct tree *t, int levels, FILE *f);
+
+
+/******************************************************************************
+   Globals
+*/
+
+/* surfaces for each UI section */
+extern struct surface tree_view;
+extern struct surface status_view;
+extern struct surface help_view;
+extern struct surface stats_view;
+
+extern int tree_area_height;
+extern int tree_win_height;
+extern int tree_win_width;
+extern int status_win_height;
+extern int stats_win_height;
+extern int help_win_height;
+extern int input_win_height;
+
+extern int screenh, screenw;
+extern int vscroll;
+extern int printed_lines;
+extern int selected_index;
+
+enum help_mode {
+	H_HIDE,
+	H_NORMAL,
+	H_EDIT
+};
+extern enum help_mode help_mode;
+extern bool show_stats;
+extern bool paste_on;
+extern char find_query[MAXLEN + 1];
+extern char *(*prompt_source)(const char *msgstr, const char *defstr);
+
+extern struct pane panes[MAX_PANES];
+extern int npanes;
+extern int current_pane;
+extern enum split split;
+
+extern struct tree **view_rows;
+extern int *view_depth;
+extern long view_nrows;
+extern long view_alloc;
+extern struct row_frame *view_stack;
+extern int view_nstack;
+extern int view_stack_alloc;
+extern unsigned long view_edits;
+extern struct tree *view_root;
+extern struct row_index shared_rows;
+extern struct row_index *view_home;
+
+extern struct tree **onscreen_entries;
+extern int onscreen_alloc;
+extern struct tree *selected_entry;
+extern struct tree *root;
+
+extern char filename[MAX_ENTRY_LEN];
+extern unsigned long saved_hash;
+extern bool repaired;
+extern unsigned long recover_hash;
+extern long unsaved_edits;
+extern double last_input;
+extern struct file_stamp disk_stamp;
+extern struct file_stamp seen_stamp;
+
+extern struct buffer *buffers;
+extern int nbuffers;
+extern int buffers_alloc;
+extern int current_buffer;
+
+extern struct tree **undo_nodes;
+extern struct tree **undo_kids;
+extern long undo_nnodes;
+
+extern char saymsg[MAX_SAY_CHARS];
+extern int sayblink;
+
+#endif /* TT_TT_H */
@@ -0,0 +1,123 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include "tree.h"
+#include "watch.h"
+
+/* inotify descriptor and the watch on the file's directory. The directory
+   is watched rather than the file so that a file replaced by renaming a
+   new one over it is still seen */
+static int watch_fd = -1;
+static int watch_wd = -1;
+static bool active;
+static char watch_name[MAX_ENTRY_LEN];
+
+/* store fname's current stamp in st */
+void stamp_file(const char *fname, struct file_stamp *st)
+{
+	struct stat sb;
+	memset(st, 0, sizeof(*st));
+	if (stat(fname, &sb) != 0)
+		return;
+	st->exists = true;
+	st->sec = sb.st_mtim.tv_sec;
+	st->nsec = sb.st_mtim.tv_nsec;
+	st->size = sb.st_size;
+	st->ino = sb.st_ino;
+}
+
+/* true if the stamps describe the same version of a file */
+bool same_stamp(const struct file_stamp *a, const struct file_stamp *b)
+{
+	return a->exists == b->exists && a->sec == b->sec
+		&& a->nsec == b->nsec && a->size == b->size && a->ino == b->ino;
+}
+
+/* watch fname for changes, replacing any previous watch */
+void watch_file(const char *fname)
+{
+	const char *base = strrchr(fname, '/');
+	char dir[MAX_ENTRY_LEN];
+
+	watch_stop();
+	if (strlen(fname) == 0 || strlen(fname) >= MAX_ENTRY_LEN)
+		return;
+	base = base == NULL ? fname : base + 1;
+	strcpy(watch_name, base);
+	if (base == fname) {
+		strcpy(dir, ".");
+	} else {
+		memcpy(dir, fname, base - fname);
+		dir[base - fname] = '\0';
+	}
+	active = true;
+#ifdef __linux__
+	if (watch_fd < 0)
+		watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch_fd >= 0) {
+		watch_wd = inotify_add_watch(watch_fd, dir, IN_CLOSE_WRITE
+				| IN_MOVED_TO | IN_CREATE | IN_DELETE);
+	}
+#endif
+}
+
+/* stop watching */
+void watch_stop()
+{
+#ifdef __linux__
+	if (watch_fd >= 0 && watch_wd >= 0)
+		inotify_rm_watch(watch_fd, watch_wd);
+#endif
+	watch_wd = -1;
+	active = false;
+}
+
+/* drain pending events, returning true if the watched file may have
+   changed. Never blocks */
+bool watch_poll()
+{
+#ifdef __linux__
+	/* the union keeps the buffer aligned for the events read into it */
+	union {
+		struct inotify_event ev;
+		char buf[4096];
+	} u;
+	const struct inotify_event *ev;
+	bool hit = false;
+	ssize_t n;
+	char *p;
+
+	if (!active || watch_wd < 0)
+		return false;
+	while ((n = read(watch_fd, u.buf, sizeof(u.buf))) > 0) {
+		for (p = u.buf; p < u.buf + n; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *)p;
+			if (ev->wd == watch_wd && ev->len > 0
+					&& strcmp(ev->name, watch_name) == 0)
+				hit = true;
+			if (ev->mask & IN_Q_OVERFLOW)
+				hit = true;
+		}
+	}
+	return hit;
+#else
+	return false;
+#endif
+}
+
+/* true while a file is being watched */
+bool watching()
+{
+	return active;
+}
+
+/* true while a file is being watched without events */
+bool watch_polling()
+{
+	return active && watch_wd < 0;
+}
@@ -0,0 +1,43 @@
+#ifndef TT_WATCH_H
+#define TT_WATCH_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+#include <time.h>
+
+/* What a file looked like on disk, to tell whether another program has
+   written it since */
+struct file_stamp {
+	bool exists;
+	time_t sec;      /* modification time */
+	long nsec;
+	off_t size;
+	ino_t ino;       /* changes when the file is replaced by a rename */
+};
+
+/* store fname's current stamp in st */
+void stamp_file(const char *fname, struct file_stamp *st);
+
+/* true if the stamps describe the same version of a file */
+bool same_stamp(const struct file_stamp *a, const struct file_stamp *b);
+
+/* watch fname for changes, replacing any previous watch. Without inotify,
+   or if the watch can't be added, no events come and the file has to be
+   polled instead */
+void watch_file(const char *fname);
+
+/* stop watching */
+void watch_stop();
+
+/* drain pending events, returning true if the watched file may have
+   changed. Never blocks, and is always false while watch_polling() */
+bool watch_poll();
+
+/* true while a file is being watched */
+bool watching();
+
+/* true while a file is being watched without events, so that only
+   looking at its stamp now and then finds changes */
+bool watch_polling();
+
+#endif /* TT_WATCH_H */